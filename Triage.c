@@ -1,200 +1,5960 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Vector instructions for the report kernels, when the compiler targets them
+// (x86-64 always has SSE2; build with -mavx2 for AVX2).
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Hot-path counters (see get_triage_stats) are compiled in unless the build
+// defines TRIAGE_NO_STATS, which turns ADD_STAT into nothing. Each one is a plain
+// increment of a field the operation already has in cache.
+#ifdef TRIAGE_NO_STATS
+#define ADD_STAT(counter, amount) ((void)sizeof((counter) += (amount)))
+#else
+#define ADD_STAT(counter, amount) ((void)((counter) += (amount)))
+#endif
+
+// Trace points are compiled in only when the build defines TRIAGE_TRACE. Each one
+// writes "trace <monotonic ns> <point> <patient_id> <value>" to stderr.
+#ifdef TRIAGE_TRACE
+void trace_point(const char* point, int patient_id, long long value) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "trace %lld%09ld %s %d %lld\n", (long long)now.tv_sec, now.tv_nsec, point, patient_id, value);
+}
+#define TRACE_POINT(point, patient_id, value) trace_point(point, patient_id, (long long)(value))
+#else
+#define TRACE_POINT(point, patient_id, value) ((void)0)
+#endif
+
+// Refers to a patient name stored in the system's NamePool (see intern_name).
+typedef uint32_t NameHandle;
+
+// Handle of the empty name, and the value returned when a name cannot be stored.
+#define EMPTY_NAME_HANDLE 0u
+#define INVALID_NAME_HANDLE UINT32_MAX
+
+// Longest name kept, in bytes; longer names are cut off.
+#define MAX_NAME_LENGTH 59
+
+// A simple structure to hold all information for a single patient.
+// The name lives out of line in the name pool, which keeps the record at 32 bytes
+// (a handle, two ints and two timestamps) so copies in the heap stay cheap.
+typedef struct {
+    NameHandle name;    // Handle into TriageSystem.names.
+    int priority_level; // A lower number means higher priority (e.g., 1 is the most critical).
+    int patient_id;
+    uint64_t arrival_time;   // Nanoseconds on the system clock since it started; set on admission.
+    uint64_t treatment_time; // Same clock, set when the patient is treated (0 while waiting).
+} Patient;
+
+// Controls how the waiting list and treated log arrays resize themselves.
+// Capacity is multiplied by growth_factor whenever an array is full, which keeps
+// appends amortized O(1). Shrinking is optional: when the number of entries drops
+// below capacity * shrink_ratio the array is reduced by one growth step. Keeping
+// shrink_ratio below 1 / growth_factor avoids resizing back and forth on every call.
+typedef struct {
+    double growth_factor; // Multiplier applied to the capacity when full (must be > 1).
+    double shrink_ratio;  // Fill ratio that triggers a shrink (0 disables shrinking).
+    int min_capacity;     // Arrays never shrink below this many entries.
+} GrowthPolicy;
+
+const GrowthPolicy DEFAULT_GROWTH_POLICY = {2.0, 0.0, 16};
+
+// A block of memory that a whole triage system is carved out of. Pieces are handed
+// out by bumping `used`; nothing is freed individually. Arrays that later outgrow
+// their carved space move to ordinary malloc memory, and the arena itself is
+// released in one go when the system is freed.
+typedef struct {
+    char* base;  // Start of the block (NULL while only measuring a layout).
+    size_t size; // Total number of bytes in the block.
+    size_t used; // Bytes handed out so far.
+    int owned;   // 1 if the system allocated the block and must free it.
+} Arena;
+
+// One entry of the heap array. The heap only moves these small nodes around;
+// the full Patient record stays put in MinHeap.patients at index `slot`.
+typedef struct {
+    uint64_t key; // Packed (priority, arrival order) key; see make_sort_key.
+    int slot;     // Index of the patient's record in MinHeap.patients.
+} HeapNode;
+
+// One bucket of the patient_id -> slot hash index kept by MinHeap.
+typedef struct {
+    int patient_id;
+    int slot; // -1 marks an empty bucket.
+} IdIndexEntry;
+
+// Open-addressing hash from patient_id to slot, using linear probing.
+typedef struct {
+    IdIndexEntry* entries;
+    int mask;  // Number of buckets minus one (a power of two minus one).
+    int shift; // 32 - log2(number of buckets), used by the hash.
+} IdIndex;
+
+// Cache line size assumed when laying out the heap array.
+#define CACHE_LINE_SIZE 64
+
+// Supported heap arities. Every arity is a power of two so parent and child
+// indexes can be computed with shifts.
+#define MIN_HEAP_ARITY 2
+#define MAX_HEAP_ARITY 8
+
+// Sift depths counted separately; a heap of at most INT_MAX nodes is at most 31
+// levels deep, so no depth falls outside.
+#define SIFT_DEPTH_BUCKETS 32
+
+// What a heap counts about its own work (see ADD_STAT).
+typedef struct {
+    uint64_t sift_up[SIFT_DEPTH_BUCKETS];   // heapify_up calls by levels moved.
+    uint64_t sift_down[SIFT_DEPTH_BUCKETS]; // heapify_down calls by levels moved.
+    uint64_t grows;                         // Successful grow_heap reallocations.
+    uint64_t shrinks;                       // shrink_heap reallocations.
+} HeapStats;
+
+// The Min-Heap structure, which will function as our Priority Queue.
+// It is a d-ary heap: node i has children arity*i+1 .. arity*i+arity. The node
+// array is offset inside a cache-line-aligned block so that each group of
+// siblings starts on a cache line, letting a 4-ary heap compare all children of
+// a node with a single line fetch (an 8-ary heap uses two adjacent lines).
+typedef struct {
+    HeapNode* nodes;        // The heap itself, ordered by key.
+    void* node_block;       // Aligned allocation that contains `nodes`.
+    int arity;              // Number of children per node (2, 4 or 8).
+    int arity_shift;        // log2(arity).
+    Patient* patients;      // Stable storage for patient records, indexed by slot.
+    int* free_slots;        // Stack of unused slots in the patients array.
+    int free_count;         // Number of entries in free_slots.
+    int* positions;         // Current index in `nodes` of the patient stored in each slot.
+    IdIndex ids;            // Finds the slot of a waiting patient by patient_id.
+    int size;               // The current number of patients in the heap.
+    int capacity;           // The allocated capacity of the nodes, patients, free_slots and positions arrays.
+    GrowthPolicy growth;    // How the arrays grow and shrink.
+    uint32_t next_sequence; // Arrival counter used to break ties within a priority level.
+    uint32_t aging_interval; // Milliseconds of waiting worth one priority level, or 0 for no aging.
+    const Arena* arena;     // Arena the arrays were first carved from, or NULL.
+    HeapStats stats;
+} MinHeap;
+
+// Number of priority levels the bucket queue engine distinguishes. Levels below 0
+// are queued as level 0 and levels above BUCKET_LEVELS - 1 as the last level; the
+// patient record keeps the real value.
+#define BUCKET_LEVELS 64
+
+// One queued entry of a bucket FIFO. The entry is stale (skipped and dropped when
+// it reaches the front) once the slot's stamp no longer matches, which is how
+// re-triage and removal work without searching the FIFO.
+typedef struct {
+    int slot;
+    uint32_t stamp;
+} BucketEntry;
+
+// A growable ring buffer of entries for one priority level.
+typedef struct {
+    BucketEntry* entries;
+    int head;     // Index of the oldest entry.
+    int count;    // Entries queued, including stale ones.
+    int capacity; // A power of two (or 0 before the first push).
+    int waiting;  // Patients waiting at this level: the live entries.
+} BucketFifo;
+
+// The bucket queue engine: an alternative to MinHeap for small integer triage
+// scales such as ESI 1-5. Each level has its own first-come, first-served FIFO and
+// a 64-bit bitmap marks the levels with queued entries, so insert is O(1) and
+// extract-min is one find-first-set instruction plus O(1) amortized work.
+typedef struct {
+    BucketFifo levels[BUCKET_LEVELS];
+    uint64_t non_empty;     // Bit i is set when levels[i] has queued entries.
+    Patient* patients;      // Stable storage for patient records, indexed by slot.
+    uint32_t* stamps;       // Stamp of each slot's one live entry.
+    uint64_t* keys;         // Sort key of the patient in each slot (see bucket_key).
+    int* free_slots;        // Stack of unused slots.
+    int free_count;
+    IdIndex ids;            // Finds the slot of a waiting patient by patient_id.
+    int size;               // Number of patients waiting.
+    int capacity;           // Allocated capacity of the per-slot arrays.
+    GrowthPolicy growth;
+    uint32_t aging_interval; // Milliseconds of waiting worth one priority level, or 0 for no aging.
+    const Arena* arena;     // Arena the arrays were first carved from, or NULL.
+    uint64_t grows;         // Successful grow_bucket_queue reallocations (see ADD_STAT).
+} BucketQueue;
+
+// The data structures a TriageSystem can use for its waiting list.
+typedef enum {
+    ENGINE_HEAP,        // The d-ary MinHeap: any priority range, O(log n) operations.
+    ENGINE_BUCKET_QUEUE // One FIFO per level: O(1) operations for small priority ranges.
+} WaitingListEngine;
+
+// One fixed-size record of the treated-patient journal. Names are stored as text
+// because name handles only mean something inside one running system. Records are
+// written in host byte order.
+typedef struct {
+    int32_t patient_id;
+    int32_t priority_level;
+    uint64_t arrival_time;
+    uint64_t treatment_time;
+    char name[MAX_NAME_LENGTH + 1];
+} TreatedJournalRecord;
+
+// The header at the start of every file of fixed-size records (the treated
+// journal and the write-ahead log).
+typedef struct {
+    char magic[4];        // Three letters naming the file type, then a zero byte.
+    uint32_t version;     // Format version of the records.
+    uint32_t record_size; // Size of one record for the writer.
+    uint32_t reserved;
+} RecordFileHeader;
+
+#define TREATED_JOURNAL_VERSION 1
+
+// An append-only file of TreatedJournalRecords. Records are collected in a buffer
+// and written with one write() per full buffer; every sync_every writes are
+// followed by one fsync, so the cost of making records durable is shared by a
+// whole group of them.
+typedef struct {
+    int fd;
+    TreatedJournalRecord* buffer;
+    int used;             // Records waiting in the buffer.
+    int capacity;         // Records the buffer holds.
+    int sync_every;       // Writes per fsync (0 leaves syncing to the OS).
+    int unsynced_writes;  // Writes since the last fsync.
+    long long records;    // Records in the file, including buffered ones.
+    int torn;             // A failed write may have left part of the buffer at the end of the file.
+} TreatedJournal;
+
+// Operations recorded in the write-ahead log.
+typedef enum {
+    WAL_ADMIT = 1,
+    WAL_TREAT,
+    WAL_RETRIAGE,
+    WAL_REMOVE
+} WalOperation;
+
+// One fixed-size write-ahead log record. Admissions carry everything needed to
+// recreate the patient exactly (ID, arrival sequence and time, name); the other
+// operations carry what the original call was given, plus the patient treated so
+// replay can confirm it is following the same history.
+typedef struct {
+    uint64_t lsn;            // Log sequence number: one higher for every record.
+    uint64_t time;           // Arrival, treatment or re-triage time (see triage_now).
+    uint64_t checksum;       // hash_bytes of the record with this field set to 0.
+    uint32_t operation;      // A WalOperation.
+    int32_t patient_id;
+    int32_t priority_level;  // New level for WAL_RETRIAGE.
+    uint32_t sequence;       // Arrival sequence for WAL_ADMIT and WAL_RETRIAGE.
+    char name[MAX_NAME_LENGTH + 1]; // WAL_ADMIT only.
+} WalRecord;
+
+#define WAL_VERSION 1
+
+// A group-committed write-ahead log. Operations are logged into a buffer as they
+// happen and reach the disk together, with one write and one fdatasync, when the
+// buffer fills or commit_write_ahead_log is called. An operation is durable once
+// a commit covering its LSN has returned.
+typedef struct {
+    int fd;
+    WalRecord* buffer;
+    int used;             // Records waiting in the buffer.
+    int capacity;         // Records the buffer holds.
+    uint64_t next_lsn;    // LSN of the next record.
+    uint64_t durable_lsn; // Highest LSN known to be on disk.
+    long long file_records; // Whole records written to the file since it was opened or reset.
+    int torn;             // A failed write may have left part of the buffer at the end of the file.
+    int failed;           // A sync failed, so written records may be lost; every later commit fails.
+} WriteAheadLog;
+
+// Wait-time histograms and the treated log's priority index are kept for priority
+// levels 0 .. WAIT_HISTOGRAM_LEVELS - 1; other levels are counted with the nearest one.
+#define WAIT_HISTOGRAM_LEVELS 8
+
+// The treated records of one priority level, in treatment order, as record numbers
+// (a record's position among all records ever appended; see TreatedLog.total).
+// Numbers of records that have left the in-memory tail are dropped from the front
+// lazily, so lookups skip any that remain.
+typedef struct {
+    long long* records;
+    int start;    // Entries before this one have left memory.
+    int count;    // Entries used, including those before `start`.
+    int capacity;
+} TreatedLevelIndex;
+
+// The treated log's records stored column-wise, one array per Patient field, so
+// reports that read one or two fields scan just those arrays. Record i is made up
+// of element i of every column.
+typedef struct {
+    int* patient_ids;
+    int* priority_levels;
+    uint64_t* arrival_times;
+    uint64_t* treatment_times;
+    NameHandle* names;
+} TreatedColumns;
+
+// The dynamic array structure for logging treated patients. Once a journal is
+// attached (see attach_treated_journal) the arrays become a ring that keeps only
+// the most recent tail_limit records, starting at `head`.
+typedef struct {
+    TreatedColumns columns;
+    int size;
+    int capacity;
+    GrowthPolicy growth;
+    const Arena* arena;
+    int head;                // Index of the oldest record (always 0 without a journal).
+    int tail_limit;          // Records kept in memory, or 0 to keep all of them.
+    long long total;         // Records ever appended, including ones dropped from the tail.
+    TreatedJournal* journal; // Receives every treated record, or NULL.
+    IdIndex ids;             // patient_id -> index in the columns (no entries before the first treatment).
+    TreatedLevelIndex levels[WAIT_HISTOGRAM_LEVELS]; // By priority level, for find_treated_by_priority.
+    uint64_t grows;          // Successful column reallocations (see ADD_STAT).
+} TreatedLog;
+
+// Things that happen inside the triage system. The core never prints; it reports
+// these events to an optional sink, which decides whether to print, buffer or drop them.
+typedef enum {
+    EVENT_PATIENT_ADMITTED,   // patient
+    EVENT_BATCH_ADMITTED,     // count, first_id, last_id
+    EVENT_PATIENT_TREATED,    // patient
+    EVENT_BATCH_TREATED,      // count, first_id, last_id
+    EVENT_PRIORITY_UPDATED,   // patient_id, priority_level
+    EVENT_PATIENT_REMOVED,    // patient
+    EVENT_WAITING_LIST_EMPTY, // (no fields)
+    EVENT_PATIENT_NOT_FOUND,  // patient_id
+    EVENT_OUT_OF_MEMORY,      // operation, count
+    EVENT_IO_ERROR            // operation, count
+} TriageEventType;
+
+// One event. Only the fields listed next to the event type are meaningful; `patient`
+// and `name` (the patient's name) point at data owned by the system and are only
+// valid during the callback.
+typedef struct {
+    TriageEventType type;
+    const Patient* patient;
+    const char* name;
+    int patient_id;
+    int priority_level;
+    int count;
+    int first_id;
+    int last_id;
+    const char* operation;
+} TriageEvent;
+
+// Stores every distinct patient name once, back to back, each ending in a NUL.
+// A name's handle is its byte offset in `text`, so looking one up is a single add.
+// A small hash table of handles lets repeated names share storage.
+typedef struct {
+    char* text;            // The names themselves; offset 0 holds the empty name.
+    int used;              // Bytes of text in use.
+    int capacity;          // Bytes allocated for text.
+    NameHandle* buckets;   // Open-addressing table of handles (0 = empty bucket).
+    int bucket_mask;       // Number of buckets minus one (a power of two minus one).
+    int count;             // Number of distinct non-empty names stored.
+    GrowthPolicy growth;   // How `text` grows.
+    const Arena* arena;    // Arena the arrays were first carved from, or NULL.
+} NamePool;
+
+// Where events go. A NULL emit function turns events off entirely, so a quiet
+// system pays nothing beyond one pointer check per operation.
+typedef struct {
+    void (*emit)(void* context, const TriageEvent* event);
+    void* context;
+} EventSink;
+
+// Values below 2^WAIT_HISTOGRAM_SUB_BITS get a bucket each, and every power-of-two
+// range above that is split into 2^(WAIT_HISTOGRAM_SUB_BITS - 1) = 32 linear
+// buckets. Percentiles report a bucket's upper edge, so they are at most 1/32
+// (about 3%) above the true value.
+#define WAIT_HISTOGRAM_SUB_BITS 6
+
+// Enough buckets for waits up to UINT32_MAX milliseconds (about 49 days).
+#define WAIT_HISTOGRAM_BUCKETS ((32 - WAIT_HISTOGRAM_SUB_BITS + 2) << (WAIT_HISTOGRAM_SUB_BITS - 1))
+
+// A log-linear (HDR-style) histogram of door-to-treatment times in milliseconds.
+// The benchmarks reuse it for operation latencies in nanoseconds.
+typedef struct {
+    uint64_t count;
+    uint64_t total; // Sum of all values.
+    uint64_t max;
+    uint32_t buckets[WAIT_HISTOGRAM_BUCKETS];
+} WaitHistogram;
+
+// Wait-time figures for one priority level, as returned by get_wait_time_summary.
+typedef struct {
+    uint64_t count; // Patients treated.
+    double mean_ms;
+    uint64_t p50_ms;
+    uint64_t p90_ms;
+    uint64_t p99_ms;
+    uint64_t max_ms;
+} WaitTimeSummary;
+
+// The spread of door-to-treatment times over the records held in memory by the
+// treated log, as returned by get_recent_wait_range.
+typedef struct {
+    uint64_t count; // Records looked at.
+    uint64_t min_ms;
+    uint64_t max_ms;
+    uint64_t percentile_ms; // The requested percentile.
+} WaitRange;
+
+// Per-priority figures for the records held in memory by the treated log, as
+// returned by report_treated_log. Levels are grouped as for the wait histograms.
+typedef struct {
+    uint64_t count[WAIT_HISTOGRAM_LEVELS];
+    double mean_wait_ms[WAIT_HISTOGRAM_LEVELS];
+} TreatedLogReport;
+
+// A source of monotonic time in nanoseconds. The default reads CLOCK_MONOTONIC;
+// tests and simulations can supply their own.
+typedef struct {
+    uint64_t (*now_ns)(void* context);
+    void* context;
+} TriageClock;
+
+// Kinds of change reported by the change feed.
+typedef enum {
+    CHANGE_ADMITTED = 1,
+    CHANGE_TREATED,
+    CHANGE_RETRIAGED,
+    CHANGE_REMOVED
+} ChangeType;
+
+// One change to the waiting list, as delivered by read_changes.
+typedef struct {
+    uint64_t sequence;  // Position in the feed: one higher for every change.
+    uint64_t time;      // triage_now() when the change happened.
+    ChangeType type;
+    int patient_id;
+    int priority_level; // The patient's level (the new one for CHANGE_RETRIAGED).
+    NameHandle name;    // The patient's name (EMPTY_NAME_HANDLE for CHANGE_RETRIAGED).
+} ChangeRecord;
+
+// A ring of the most recent waiting-list changes. Subscribers do not register:
+// each keeps a cursor (the sequence of the next change it wants) and pulls what
+// is new, so any number of displays cost the system one record per change.
+typedef struct {
+    ChangeRecord* records;
+    uint64_t mask;          // Number of records minus one (a power of two minus one).
+    uint64_t next_sequence; // Sequence the next change will get.
+} ChangeFeed;
+
+// Operations counted in TriageStats.
+typedef enum {
+    STAT_ADMIT,
+    STAT_BULK_ADMIT,
+    STAT_TREAT,
+    STAT_BATCH_TREAT,
+    STAT_RETRIAGE,
+    STAT_REMOVE,
+    STAT_OPERATION_COUNT
+} StatOperation;
+
+// Per-operation counters of a system (see ADD_STAT). A call that fails counts in
+// `calls` but adds no patients.
+typedef struct {
+    uint64_t calls[STAT_OPERATION_COUNT];
+    uint64_t patients[STAT_OPERATION_COUNT]; // Patients admitted, treated, re-triaged or removed.
+} TriageStats;
+
+// A main structure to hold pointers to our heap and log. Exactly one of
+// waiting_list and bucket_list is in use, as selected by `engine`.
+typedef struct {
+    WaitingListEngine engine;
+    MinHeap* waiting_list;
+    BucketQueue* bucket_list;
+    TreatedLog* treated_log;
+    NamePool names;
+    int next_patient_id;
+    uint32_t next_sequence; // Arrival counter shared by whichever engine is in use.
+    TriageClock clock;
+    uint64_t epoch_ns;      // Clock reading when the system started, the zero of arrival times.
+    WaitHistogram* wait_histograms; // WAIT_HISTOGRAM_LEVELS histograms, allocated on the first treatment.
+    WriteAheadLog* wal;     // Receives every operation, or NULL.
+    uint64_t applied_lsn;   // LSN of the last operation logged or replayed (0 for none).
+    ChangeFeed* changes;    // Recent waiting-list changes for subscribers, or NULL.
+    int shared_keys;        // Nonzero when other systems compare this one's keys, which rules out aging.
+    TriageStats stats;
+    EventSink events;
+    Arena arena; // The memory this system and its initial arrays were carved from.
+} TriageSystem;
+
+// Walks the waiting list in treatment order without changing it (see
+// open_waiting_list_iterator). Any change to the waiting list invalidates it.
+typedef struct {
+    const TriageSystem* system;
+    int remaining;              // Patients still to be returned.
+    int* candidates;            // Heap engine: binary heap of node indexes not yet returned.
+    int candidate_count;
+    int positions[BUCKET_LEVELS]; // Bucket engine: entries of each FIFO already passed.
+} WaitingListIterator;
+
+// Alignment used for ordinary pieces carved out of an arena.
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+// Carves `bytes` bytes aligned to `alignment` (a power of two) out of the arena.
+// Returns NULL if the arena is too small. An arena with a NULL base only measures:
+// it advances `used` as if the memory had been handed out but always returns NULL.
+void* arena_alloc(Arena* arena, size_t bytes, size_t alignment) {
+    uintptr_t start = (uintptr_t)arena->base + arena->used;
+    uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t offset = (size_t)(aligned - (uintptr_t)arena->base);
+    if (offset > arena->size || bytes > arena->size - offset) {
+        return NULL;
+    }
+    arena->used = offset + bytes;
+    return arena->base == NULL ? NULL : (void*)aligned;
+}
+
+// Returns 1 if `block` points into the arena's memory.
+int arena_contains(const Arena* arena, const void* block) {
+    if (arena == NULL || arena->base == NULL) {
+        return 0;
+    }
+    uintptr_t address = (uintptr_t)block;
+    return address >= (uintptr_t)arena->base && address < (uintptr_t)arena->base + arena->size;
+}
+
+// Frees a block unless it was carved from the arena, which is released as a whole.
+void release_block(const Arena* arena, void* block) {
+    if (!arena_contains(arena, block)) {
+        free(block);
+    }
+}
+
+// Returns a copy of the policy with out-of-range values replaced by safe defaults.
+GrowthPolicy sanitize_growth_policy(GrowthPolicy policy) {
+    if (policy.growth_factor <= 1.0) {
+        policy.growth_factor = DEFAULT_GROWTH_POLICY.growth_factor;
+    }
+    // A shrink ratio at or above 1 / growth_factor would undo every growth step.
+    if (policy.shrink_ratio < 0.0 || policy.shrink_ratio >= 1.0 / policy.growth_factor) {
+        policy.shrink_ratio = 0.0;
+    }
+    if (policy.min_capacity < 1) {
+        policy.min_capacity = 1;
+    }
+    return policy;
+}
+
+// Resizes a dynamic array from old_capacity to exactly new_capacity elements.
+// An array that still lives in its arena cannot be passed to realloc: growing it
+// copies it out to malloc memory, and shrinking it just keeps the arena space.
+// Returns 0 on success, or -1 (leaving the array untouched) if memory runs out.
+int resize_array(const Arena* arena, void** array, int old_capacity, int new_capacity, size_t element_size) {
+    if (arena_contains(arena, *array)) {
+        if (new_capacity <= old_capacity) {
+            return 0;
+        }
+        void* moved = malloc((size_t)new_capacity * element_size);
+        if (moved == NULL) {
+            return -1;
+        }
+        memcpy(moved, *array, (size_t)old_capacity * element_size);
+        *array = moved;
+        return 0;
+    }
+    void* resized = realloc(*array, (size_t)new_capacity * element_size);
+    if (resized == NULL) {
+        return -1;
+    }
+    *array = resized;
+    return 0;
+}
+
+// Returns the capacity an array should grow to so it can hold `required` elements.
+int grown_capacity(const GrowthPolicy* policy, int capacity, int required) {
+    double grown = (double)capacity * policy->growth_factor;
+    int new_capacity = grown > (double)INT_MAX ? INT_MAX : (int)grown;
+    if (new_capacity <= capacity) {
+        new_capacity = capacity + 1; // Tiny arrays may not grow under the factor alone.
+    }
+    if (new_capacity < required) {
+        new_capacity = required;
+    }
+    if (new_capacity < policy->min_capacity) {
+        new_capacity = policy->min_capacity;
+    }
+    return new_capacity;
+}
+
+// Returns the capacity a mostly empty array should shrink to, or the current
+// capacity if the policy says it should stay as it is.
+int shrunk_capacity(const GrowthPolicy* policy, int capacity, int size) {
+    if (policy->shrink_ratio <= 0.0 || capacity <= policy->min_capacity) {
+        return capacity;
+    }
+    if ((double)size >= (double)capacity * policy->shrink_ratio) {
+        return capacity;
+    }
+    int new_capacity = (int)((double)capacity / policy->growth_factor);
+    if (new_capacity < policy->min_capacity) {
+        new_capacity = policy->min_capacity;
+    }
+    if (new_capacity < size) {
+        new_capacity = size;
+    }
+    return new_capacity < capacity ? new_capacity : capacity;
+}
+
+// Makes sure a dynamic array can hold at least `required` elements, growing it
+// geometrically according to the policy. Returns 0 on success, -1 on failure.
+int reserve_capacity(const Arena* arena, void** array, int* capacity, int required, size_t element_size, const GrowthPolicy* policy) {
+    if (required <= *capacity) {
+        return 0;
+    }
+    int new_capacity = grown_capacity(policy, *capacity, required);
+    if (resize_array(arena, array, *capacity, new_capacity, element_size) != 0) {
+        return -1;
+    }
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Pushes the slots [from, to) onto the heap's free slot stack, lowest slot on top.
+void push_free_slots(MinHeap* heap, int from, int to) {
+    for (int slot = to - 1; slot >= from; slot--) {
+        heap->free_slots[heap->free_count++] = slot;
+    }
+}
+
+// Number of padding nodes placed in front of the node array. Sibling groups start
+// at index arity*i+1, so shifting the array back by one node from a line boundary
+// puts every group at the start of a cache line.
+#define NODE_ARRAY_OFFSET (CACHE_LINE_SIZE / sizeof(HeapNode) - 1)
+
+// Returns the size of the cache-line-aligned block that holds `capacity` heap nodes.
+size_t node_block_bytes(int capacity) {
+    size_t bytes = ((size_t)capacity + NODE_ARRAY_OFFSET) * sizeof(HeapNode);
+    return (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE; // aligned_alloc needs a multiple.
+}
+
+// Allocates room for `capacity` heap nodes laid out as described at MinHeap.
+// Returns the usable node pointer and stores the block to free in *block,
+// or returns NULL if memory runs out.
+HeapNode* allocate_node_array(int capacity, void** block) {
+    *block = aligned_alloc(CACHE_LINE_SIZE, node_block_bytes(capacity));
+    if (*block == NULL) {
+        return NULL;
+    }
+    return (HeapNode*)*block + NODE_ARRAY_OFFSET;
+}
+
+// Moves the heap's live nodes into a new aligned array with room for new_capacity nodes.
+// realloc cannot be used here because it does not preserve the alignment.
+// Like resize_array, a node array still in its arena is kept when shrinking.
+// Returns 0 on success, or -1 (leaving the heap untouched) if memory runs out.
+int resize_node_array(MinHeap* heap, int new_capacity) {
+    if (new_capacity <= heap->capacity && arena_contains(heap->arena, heap->node_block)) {
+        return 0;
+    }
+    void* block;
+    HeapNode* nodes = allocate_node_array(new_capacity, &block);
+    if (nodes == NULL) {
+        return -1;
+    }
+    memcpy(nodes, heap->nodes, (size_t)heap->size * sizeof(HeapNode));
+    release_block(heap->arena, heap->node_block);
+    heap->nodes = nodes;
+    heap->node_block = block;
+    return 0;
+}
+
+// Returns the bucket where a patient_id's probe sequence starts.
+// Fibonacci hashing spreads the mostly sequential IDs evenly over the table.
+int id_index_home(const IdIndex* index, int patient_id) {
+    return (int)(((uint32_t)patient_id * 2654435769u) >> index->shift);
+}
+
+// Returns the slot recorded for the given patient, or -1 if there is none.
+int id_index_find(const IdIndex* index, int patient_id) {
+    int bucket = id_index_home(index, patient_id);
+    while (index->entries[bucket].slot != -1) {
+        if (index->entries[bucket].patient_id == patient_id) {
+            return index->entries[bucket].slot;
+        }
+        bucket = (bucket + 1) & index->mask;
+    }
+    return -1;
+}
+
+// Records that patient_id lives in `slot`, replacing any earlier entry for that ID.
+void id_index_put(IdIndex* index, int patient_id, int slot) {
+    int bucket = id_index_home(index, patient_id);
+    while (index->entries[bucket].slot != -1 && index->entries[bucket].patient_id != patient_id) {
+        bucket = (bucket + 1) & index->mask;
+    }
+    index->entries[bucket].patient_id = patient_id;
+    index->entries[bucket].slot = slot;
+}
+
+// Removes patient_id from the index if it still points at `slot`. Later entries of the
+// probe run are shifted back into the gap so lookups never need tombstones.
+void id_index_erase(IdIndex* index, int patient_id, int slot) {
+    IdIndexEntry* entries = index->entries;
+    int mask = index->mask;
+    int bucket = id_index_home(index, patient_id);
+    while (entries[bucket].slot != -1 && entries[bucket].patient_id != patient_id) {
+        bucket = (bucket + 1) & mask;
+    }
+    if (entries[bucket].slot != slot) {
+        return;
+    }
+    int hole = bucket;
+    for (int next = (hole + 1) & mask; entries[next].slot != -1; next = (next + 1) & mask) {
+        int home = id_index_home(index, entries[next].patient_id);
+        // Move the entry back only if the hole lies on its probe path (home .. next, cyclically).
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            entries[hole] = entries[next];
+            hole = next;
+        }
+    }
+    entries[hole].slot = -1;
+}
+
+// Points the index at `entries` (with the given power-of-two number of buckets) and empties it.
+void reset_id_index(IdIndex* index, IdIndexEntry* entries, int buckets) {
+    int shift = 32;
+    for (int b = buckets; b > 1; b >>= 1) {
+        shift--;
+    }
+    for (int i = 0; i < buckets; i++) {
+        entries[i].slot = -1;
+    }
+    index->entries = entries;
+    index->mask = buckets - 1;
+    index->shift = shift;
+}
+
+// Returns the number of ID index buckets that keeps the index at most half full
+// for `capacity` patients (always a power of two, at least 16).
+int id_index_bucket_count(int capacity) {
+    int buckets = 16;
+    while (buckets < 2 * capacity && buckets < (1 << 30)) {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+// Makes `index` (with the given number of buckets) the heap's ID index, releasing
+// the previous one, and refills it and every slot's position from the heap nodes.
+void install_heap_index(MinHeap* heap, IdIndexEntry* index, int buckets) {
+    if (heap->ids.entries != NULL) {
+        release_block(heap->arena, heap->ids.entries);
+    }
+    reset_id_index(&heap->ids, index, buckets);
+    for (int i = 0; i < heap->size; i++) {
+        int slot = heap->nodes[i].slot;
+        heap->positions[slot] = i;
+        id_index_put(&heap->ids, heap->patients[slot].patient_id, slot);
+    }
+}
+
+// Rebuilds the ID index at the right size for `capacity` patients, and refreshes
+// every slot's position. Returns 0 on success, -1 on failure.
+int rebuild_heap_index(MinHeap* heap, int capacity) {
+    int buckets = id_index_bucket_count(capacity);
+    IdIndexEntry* index = (IdIndexEntry*)malloc((size_t)buckets * sizeof(IdIndexEntry));
+    if (index == NULL) {
+        return -1;
+    }
+    install_heap_index(heap, index, buckets);
+    return 0;
+}
+
+// Returns the arity itself if it is supported (a power of two from 2 to 8), or 2.
+int normalize_arity(int arity) {
+    if (arity < MIN_HEAP_ARITY || arity > MAX_HEAP_ARITY || (arity & (arity - 1)) != 0) {
+        return MIN_HEAP_ARITY;
+    }
+    return arity;
+}
+
+// Fills in an empty heap whose arrays (node_block, nodes, patients, free_slots,
+// positions, and an ID index of id_index_bucket_count(capacity) buckets) and arena
+// pointer have already been set by the caller.
+void init_heap(MinHeap* heap, int capacity, int arity) {
+    heap->arity = normalize_arity(arity);
+    heap->arity_shift = 0;
+    while ((1 << heap->arity_shift) < heap->arity) {
+        heap->arity_shift++;
+    }
+    heap->free_count = 0;
+    heap->size = 0;
+    heap->capacity = capacity;
+    heap->growth = DEFAULT_GROWTH_POLICY;
+    heap->next_sequence = 0;
+    heap->aging_interval = 0;
+    memset(&heap->stats, 0, sizeof(heap->stats));
+    push_free_slots(heap, 0, capacity);
+    IdIndexEntry* index = heap->ids.entries;
+    heap->ids.entries = NULL;
+    install_heap_index(heap, index, id_index_bucket_count(capacity));
+}
+
+// Creates and returns a pointer to a new Min-Heap with the given number of
+// children per node. Arity 2 is the classic binary heap; 4 and 8 trade a few
+// more comparisons per level for a shallower tree and fewer cache misses.
+// Unsupported arities fall back to 2.
+MinHeap* create_heap(int capacity, int arity) {
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    MinHeap* heap = (MinHeap*)malloc(sizeof(MinHeap));
+    heap->arena = NULL;
+    heap->nodes = allocate_node_array(capacity, &heap->node_block);
+    heap->patients = (Patient*)malloc(capacity * sizeof(Patient));
+    heap->free_slots = (int*)malloc(capacity * sizeof(int));
+    heap->positions = (int*)malloc(capacity * sizeof(int));
+    heap->ids.entries = (IdIndexEntry*)malloc(id_index_bucket_count(capacity) * sizeof(IdIndexEntry));
+    init_heap(heap, capacity, arity);
+    return heap;
+}
+
+// Frees a heap created by create_heap, or the parts of an arena-backed heap
+// that have moved out of their arena.
+void free_heap(MinHeap* heap) {
+    const Arena* arena = heap->arena;
+    release_block(arena, heap->node_block);
+    release_block(arena, heap->patients);
+    release_block(arena, heap->free_slots);
+    release_block(arena, heap->positions);
+    release_block(arena, heap->ids.entries);
+    release_block(arena, heap);
+}
+
+// Grows every heap array together so that at least `required` patients fit.
+// Returns 0 on success, or -1 if memory runs out (the heap is left unchanged).
+int grow_heap(MinHeap* heap, int required) {
+    if (required <= heap->capacity) {
+        return 0;
+    }
+    int new_capacity = grown_capacity(&heap->growth, heap->capacity, required);
+    if (resize_node_array(heap, new_capacity) != 0 ||
+        resize_array(heap->arena, (void**)&heap->patients, heap->capacity, new_capacity, sizeof(Patient)) != 0 ||
+        resize_array(heap->arena, (void**)&heap->free_slots, heap->capacity, new_capacity, sizeof(int)) != 0 ||
+        resize_array(heap->arena, (void**)&heap->positions, heap->capacity, new_capacity, sizeof(int)) != 0) {
+        return -1;
+    }
+    if (2 * new_capacity > heap->ids.mask + 1 && rebuild_heap_index(heap, new_capacity) != 0) {
+        return -1;
+    }
+    push_free_slots(heap, heap->capacity, new_capacity);
+    heap->capacity = new_capacity;
+    ADD_STAT(heap->stats.grows, 1);
+    TRACE_POINT("heap_grow", -1, new_capacity);
+    return 0;
+}
+
+// Releases memory once the heap has become mostly empty, as allowed by its policy.
+// Records stored above the new capacity are moved into free low slots first, so
+// every slot number stays below capacity. Shrinking is best effort: if a scratch
+// buffer cannot be allocated, the heap simply keeps its larger arrays.
+void shrink_heap(MinHeap* heap) {
+    int new_capacity = shrunk_capacity(&heap->growth, heap->capacity, heap->size);
+    if (new_capacity == heap->capacity) {
+        return;
+    }
+    char* in_use = (char*)calloc(new_capacity, 1);
+    if (in_use == NULL) {
+        return;
+    }
+    for (int i = 0; i < heap->size; i++) {
+        if (heap->nodes[i].slot < new_capacity) {
+            in_use[heap->nodes[i].slot] = 1;
+        }
+    }
+    // Relocate records that live above the new capacity into the lowest free slots.
+    int candidate = 0;
+    for (int i = 0; i < heap->size; i++) {
+        if (heap->nodes[i].slot >= new_capacity) {
+            while (in_use[candidate]) {
+                candidate++;
+            }
+            heap->patients[candidate] = heap->patients[heap->nodes[i].slot];
+            heap->nodes[i].slot = candidate;
+            in_use[candidate] = 1;
+        }
+    }
+    heap->free_count = 0;
+    for (int slot = new_capacity - 1; slot >= 0; slot--) {
+        if (!in_use[slot]) {
+            heap->free_slots[heap->free_count++] = slot;
+        }
+    }
+    free(in_use);
+
+    // Shrinking calls do not fail in practice; if one does, the old block is kept.
+    resize_node_array(heap, new_capacity);
+    resize_array(heap->arena, (void**)&heap->patients, heap->capacity, new_capacity, sizeof(Patient));
+    resize_array(heap->arena, (void**)&heap->free_slots, heap->capacity, new_capacity, sizeof(int));
+    resize_array(heap->arena, (void**)&heap->positions, heap->capacity, new_capacity, sizeof(int));
+    heap->capacity = new_capacity;
+    ADD_STAT(heap->stats.shrinks, 1);
+    TRACE_POINT("heap_shrink", -1, new_capacity);
+
+    // Slots have moved, so positions and the ID index are refreshed (and the index
+    // shrunk along with the heap). If that fails, keep the old index and just fix it up.
+    if (rebuild_heap_index(heap, new_capacity) != 0) {
+        for (int i = 0; i < heap->size; i++) {
+            int slot = heap->nodes[i].slot;
+            heap->positions[slot] = i;
+            id_index_put(&heap->ids, heap->patients[slot].patient_id, slot);
+        }
+    }
+}
+
+// Packs a priority level and an arrival sequence number into one 64-bit key.
+// The priority goes in the high 32 bits (biased so negative levels still sort first)
+// and the arrival order in the low 32 bits, so a single unsigned comparison orders
+// patients by priority and then first-come, first-served within the same level.
+uint64_t make_sort_key(int priority_level, uint32_t sequence) {
+    uint32_t biased_priority = (uint32_t)priority_level ^ 0x80000000u;
+    return ((uint64_t)biased_priority << 32) | sequence;
+}
+
+// Layout limits of aged keys (see make_aged_key).
+#define AGING_SEQUENCE_BITS 23
+#define MAX_AGING_LEVEL 65535
+#define MAX_AGING_INTERVAL (1u << 24)
+
+// Returns the priority level used in aged keys: levels are clamped to 0..MAX_AGING_LEVEL.
+uint64_t aging_level(int priority_level) {
+    if (priority_level < 0) {
+        return 0;
+    }
+    return priority_level > MAX_AGING_LEVEL ? MAX_AGING_LEVEL : (uint64_t)priority_level;
+}
+
+// Packs a key for a waiting list with aging, where every `interval` milliseconds of
+// waiting count as one level more urgent. A patient's effective level at time t is
+// level - (t - arrival) / interval, and comparing two of those at the same t is the
+// same as comparing level * interval + arrival, which does not depend on t. So an
+// aged key never has to be recomputed while the patient waits, and the heap never
+// needs a rebuild. The aged value goes in the high bits and the low
+// AGING_SEQUENCE_BITS of the arrival sequence break ties, which keeps arrivals in
+// the same millisecond first-come, first-served. Arrival times must stay below
+// 2^40 ms (about 34 years).
+uint64_t make_aged_key(int priority_level, uint32_t sequence, uint64_t arrival_ms, uint32_t interval) {
+    uint64_t aged = arrival_ms + aging_level(priority_level) * interval;
+    return (aged << AGING_SEQUENCE_BITS) | (sequence & ((1u << AGING_SEQUENCE_BITS) - 1));
+}
+
+// Milliseconds in an arrival time, the unit aged keys count in.
+#define NS_PER_MS 1000000u
+
+// Returns the key of a patient arriving at arrival_time (in nanoseconds) under the
+// heap's aging setting.
+uint64_t heap_sort_key(const MinHeap* heap, int priority_level, uint32_t sequence, uint64_t arrival_time) {
+    if (heap->aging_interval == 0) {
+        return make_sort_key(priority_level, sequence);
+    }
+    return make_aged_key(priority_level, sequence, arrival_time / NS_PER_MS, heap->aging_interval);
+}
+
+// Defines a d-ary min-priority queue over a caller-owned array, specialized at
+// compile time so every comparison is inlined and no function pointer is involved:
+//
+//   Type                    element type stored in the array
+//   Context                 extra argument passed to KEY_OF and ON_MOVE (e.g. a
+//                           positions array); use void* and ignore it if unneeded
+//   KEY_OF(context, item)   the key an element is ordered by
+//   LESS(a, b)              nonzero if key a outranks key b
+//   ARITY                   children per node, a power of two
+//   ON_MOVE(context, item, index)  called whenever an element lands at `index`
+//
+// It defines, with `name` as prefix:
+//
+//   int  name_sift_up(Type* items, int index, Context context)
+//   int  name_sift_down(Type* items, int size, int index, Context context)
+//   void name_push(Type* items, int* size, Type item, Context context)
+//   Type name_pop(Type* items, int* size, Context context)
+//
+// The sifts return the number of levels the element moved. Instead of swapping at
+// every level, the element is lifted out and the others slide into the "hole" it
+// leaves, so it is written exactly once, at its final position. push and pop need
+// room for one more element and a non-empty queue respectively.
+#define DEFINE_PRIORITY_QUEUE(name, Type, Context, KEY_OF, LESS, ARITY, ON_MOVE)  \
+    int name##_sift_up(Type* items, int index, Context context) {                 \
+        (void)context; /* Not every instance's KEY_OF and ON_MOVE use it. */      \
+        Type moving = items[index];                                               \
+        int levels = 0;                                                           \
+        while (index > 0) {                                                       \
+            int parent = (index - 1) / (ARITY);                                   \
+            if (!LESS(KEY_OF(context, moving), KEY_OF(context, items[parent]))) { \
+                break;                                                            \
+            }                                                                     \
+            items[index] = items[parent];                                         \
+            ON_MOVE(context, items[index], index);                                \
+            index = parent;                                                       \
+            levels++;                                                             \
+        }                                                                         \
+        items[index] = moving;                                                    \
+        ON_MOVE(context, moving, index);                                          \
+        return levels;                                                            \
+    }                                                                             \
+                                                                                  \
+    int name##_sift_down(Type* items, int size, int index, Context context) {     \
+        (void)context;                                                            \
+        Type moving = items[index];                                               \
+        int levels = 0;                                                           \
+        for (;;) {                                                                \
+            int first_child = index * (ARITY) + 1;                                \
+            if (first_child >= size) {                                            \
+                break;                                                            \
+            }                                                                     \
+            int last_child = first_child + (ARITY);                               \
+            if (last_child > size) {                                              \
+                last_child = size;                                                \
+            }                                                                     \
+            int child = first_child;                                              \
+            for (int c = first_child + 1; c < last_child; c++) {                  \
+                if (LESS(KEY_OF(context, items[c]), KEY_OF(context, items[child]))) { \
+                    child = c;                                                    \
+                }                                                                 \
+            }                                                                     \
+            if (!LESS(KEY_OF(context, items[child]), KEY_OF(context, moving))) {  \
+                break;                                                            \
+            }                                                                     \
+            items[index] = items[child];                                          \
+            ON_MOVE(context, items[index], index);                                \
+            index = child;                                                        \
+            levels++;                                                             \
+        }                                                                         \
+        items[index] = moving;                                                    \
+        ON_MOVE(context, moving, index);                                          \
+        return levels;                                                            \
+    }                                                                             \
+                                                                                  \
+    void name##_push(Type* items, int* size, Type item, Context context) {        \
+        items[*size] = item;                                                      \
+        name##_sift_up(items, (*size)++, context);                                \
+    }                                                                             \
+                                                                                  \
+    Type name##_pop(Type* items, int* size, Context context) {                    \
+        Type best = items[0];                                                     \
+        if (--*size > 0) {                                                        \
+            items[0] = items[*size];                                              \
+            name##_sift_down(items, *size, 0, context);                           \
+        }                                                                         \
+        return best;                                                              \
+    }
+
+// Parameters of the waiting-list heaps: nodes ordered by key, and every node that
+// moves updates `positions`, which keeps lookups by ID O(1).
+#define HEAP_NODE_KEY(positions, node) ((node).key)
+#define HEAP_KEY_LESS(a, b) ((a) < (b))
+#define HEAP_NODE_MOVED(positions, node, index) ((positions)[(node).slot] = (index))
+
+DEFINE_PRIORITY_QUEUE(binary_heap_nodes, HeapNode, int*, HEAP_NODE_KEY, HEAP_KEY_LESS, 2, HEAP_NODE_MOVED)
+DEFINE_PRIORITY_QUEUE(quaternary_heap_nodes, HeapNode, int*, HEAP_NODE_KEY, HEAP_KEY_LESS, 4, HEAP_NODE_MOVED)
+DEFINE_PRIORITY_QUEUE(octonary_heap_nodes, HeapNode, int*, HEAP_NODE_KEY, HEAP_KEY_LESS, 8, HEAP_NODE_MOVED)
+
+// This function restores the heap property by moving a node up the tree.
+// It's used after inserting a new patient. The heap's arity picks the matching
+// specialized sift, so the loop itself has no runtime arity.
+void heapify_up(MinHeap* heap, int index) {
+    int levels;
+    switch (heap->arity) {
+    case 4:
+        levels = quaternary_heap_nodes_sift_up(heap->nodes, index, heap->positions);
+        break;
+    case 8:
+        levels = octonary_heap_nodes_sift_up(heap->nodes, index, heap->positions);
+        break;
+    default:
+        levels = binary_heap_nodes_sift_up(heap->nodes, index, heap->positions);
+        break;
+    }
+    ADD_STAT(heap->stats.sift_up[levels], 1);
+}
+
+// This function restores the heap property by moving a node down the tree.
+// It's used after removing the top patient. All children of a node sit in the
+// same cache line(s), so picking the smallest costs one or two line fetches.
+void heapify_down(MinHeap* heap, int index) {
+    int levels;
+    switch (heap->arity) {
+    case 4:
+        levels = quaternary_heap_nodes_sift_down(heap->nodes, heap->size, index, heap->positions);
+        break;
+    case 8:
+        levels = octonary_heap_nodes_sift_down(heap->nodes, heap->size, index, heap->positions);
+        break;
+    default:
+        levels = binary_heap_nodes_sift_down(heap->nodes, heap->size, index, heap->positions);
+        break;
+    }
+    ADD_STAT(heap->stats.sift_down[levels], 1);
+}
+
+// Inserts a patient whose arrival sequence and arrival time (in nanoseconds) were
+// assigned by the caller, e.g. from a counter shared by several heaps.
+// Returns 0 on success, or -1 if out of memory.
+int insert_patient_with_sequence(MinHeap* heap, Patient patient, uint32_t sequence, uint64_t arrival_time) {
+    if (grow_heap(heap, heap->size + 1) != 0) {
+        return -1;
+    }
+    // Store the record in a free slot; from here on only its node moves.
+    int slot = heap->free_slots[--heap->free_count];
+    patient.arrival_time = arrival_time;
+    patient.treatment_time = 0;
+    heap->patients[slot] = patient;
+    id_index_put(&heap->ids, patient.patient_id, slot);
+
+    int index = heap->size++;
+    heap->nodes[index].key = heap_sort_key(heap, patient.priority_level, sequence, arrival_time);
+    heap->nodes[index].slot = slot;
+    heapify_up(heap, index);
+    return 0;
+}
+
+// Inserts a new patient into the heap, growing the arrays if they are full.
+// Returns 0 on success, or -1 if there was not enough memory to grow.
+int insert_patient_to_heap(MinHeap* heap, Patient patient) {
+    // Stamp the arrival order so equal priorities leave in the order they arrived.
+    // The 32-bit counter only wraps after about four billion insertions into one heap.
+    // A standalone heap has no clock, so an aging heap sees every patient arrive at 0.
+    return insert_patient_with_sequence(heap, patient, heap->next_sequence++, 0);
+}
+
+// Appends `count` patients to the heap and restores the heap property in linear time.
+// Instead of sifting each new node up (O(count log n)), this runs Floyd's bottom-up
+// heapify over just the part of the tree above the appended range: each pass sifts
+// down the parents of the previous range, so the ranges shrink by a factor of arity
+// per level until they reach the root. If first_id is not negative, the patients are
+// given consecutive IDs starting at first_id instead of their own patient_id values.
+// Arrival sequences are first_sequence, first_sequence + 1, ... in array order, and
+// the whole batch arrives at arrival_time.
+// Returns 0 on success, or -1 (adding nobody) if there was not enough memory to grow.
+int append_patients_to_heap(MinHeap* heap, const Patient* patients, int count, int first_id, uint32_t first_sequence,
+                            uint64_t arrival_time) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (count > INT_MAX - heap->size || grow_heap(heap, heap->size + count) != 0) {
+        return -1;
+    }
+    int first_index = heap->size;
+    for (int i = 0; i < count; i++) {
+        int slot = heap->free_slots[--heap->free_count];
+        Patient* record = &heap->patients[slot];
+        *record = patients[i];
+        if (first_id >= 0) {
+            record->patient_id = first_id + i;
+        }
+        record->arrival_time = arrival_time;
+        record->treatment_time = 0;
+        id_index_put(&heap->ids, record->patient_id, slot);
+        int index = heap->size++;
+        heap->nodes[index].key = heap_sort_key(heap, record->priority_level, first_sequence + (uint32_t)i, arrival_time);
+        heap->nodes[index].slot = slot;
+        heap->positions[slot] = index;
+    }
+
+    int low = first_index;
+    int high = heap->size - 1;
+    while (high > 0) {
+        low = low > 0 ? (low - 1) >> heap->arity_shift : 0;
+        high = (high - 1) >> heap->arity_shift;
+        for (int i = high; i >= low; i--) {
+            heapify_down(heap, i);
+        }
+    }
+    return 0;
+}
+
+// Inserts a batch of patients, keeping their own IDs, in linear time.
+// Returns 0 on success, or -1 if there was not enough memory to grow.
+int insert_patients_bulk(MinHeap* heap, const Patient* patients, int count) {
+    if (append_patients_to_heap(heap, patients, count, -1, heap->next_sequence, 0) != 0) {
+        return -1;
+    }
+    heap->next_sequence += (uint32_t)count;
+    return 0;
+}
+
+// Returns the highest-priority patient without removing it, or NULL if the heap is empty.
+const Patient* peek_min(const MinHeap* heap) {
+    if (heap->size == 0) {
+        return NULL;
+    }
+    return &heap->patients[heap->nodes[0].slot];
+}
+
+// Removes the node at `index` and returns its patient record. The last node is
+// moved into the gap and sifted whichever way its key requires.
+Patient remove_heap_node(MinHeap* heap, int index) {
+    int slot = heap->nodes[index].slot;
+    Patient removed = heap->patients[slot];
+    id_index_erase(&heap->ids, removed.patient_id, slot);
+    heap->free_slots[heap->free_count++] = slot;
+    heap->size--;
+    if (index < heap->size) {
+        heap->nodes[index] = heap->nodes[heap->size];
+        heap->positions[heap->nodes[index].slot] = index;
+        if (index > 0 && heap->nodes[index].key < heap->nodes[(index - 1) >> heap->arity_shift].key) {
+            heapify_up(heap, index);
+        } else {
+            heapify_down(heap, index);
+        }
+    }
+
+    shrink_heap(heap);
+    return removed;
+}
+
+// Extracts the highest-priority patient (the root) from the heap.
+Patient extract_min(MinHeap* heap) {
+    if (heap->size <= 0) {
+        Patient empty_patient = {EMPTY_NAME_HANDLE, -1, -1, 0, 0}; // Return an invalid patient to indicate error.
+        return empty_patient;
+    }
+    return remove_heap_node(heap, 0);
+}
+
+// qsort comparison for heap indexes in ascending order.
+int compare_ints(const void* a, const void* b) {
+    int left = *(const int*)a;
+    int right = *(const int*)b;
+    return (left > right) - (left < right);
+}
+
+// Parameters of the candidate heaps used to walk a waiting-list heap in order: node
+// indexes, ordered by the keys of the nodes they refer to.
+#define CANDIDATE_KEY(nodes, candidate) ((nodes)[candidate].key)
+#define CANDIDATE_MOVED(nodes, candidate, index) ((void)0)
+
+DEFINE_PRIORITY_QUEUE(node_candidates, int, const HeapNode*, CANDIDATE_KEY, HEAP_KEY_LESS, 2, CANDIDATE_MOVED)
+
+// Removes and returns the best entry of a binary heap of node indexes, ordered by
+// the keys of the nodes they refer to.
+int pop_node_candidate(const HeapNode* nodes, int* candidates, int* candidate_count) {
+    return node_candidates_pop(candidates, candidate_count, nodes);
+}
+
+// Adds the children of heap node `parent` to a binary heap of candidate node indexes.
+void push_child_candidates(const MinHeap* heap, int parent, int* candidates, int* candidate_count) {
+    int first_child = (parent << heap->arity_shift) + 1;
+    for (int c = first_child; c < first_child + heap->arity && c < heap->size; c++) {
+        node_candidates_push(candidates, candidate_count, c, heap->nodes);
+    }
+}
+
+// Returns the most candidate node indexes that selecting k nodes of the heap can
+// leave queued at once: every chosen node swaps one candidate for up to `arity`.
+int node_candidate_capacity(const MinHeap* heap, int k) {
+    int64_t capacity = (int64_t)k * (heap->arity - 1) + 1;
+    return capacity < heap->size ? (int)capacity : heap->size;
+}
+
+// Finds the indexes of the k highest-priority nodes, in priority order, without
+// changing the heap. Because every parent outranks its children, the next node in
+// order is always a child of one already chosen, so a small candidate heap of at
+// most 1 + k * (arity - 1) indexes is enough: O(k log k) work instead of touching
+// the whole array. Returns the number of indexes written to `selected` (at most k),
+// or -1 if the candidate buffer could not be allocated.
+int select_top_nodes(const MinHeap* heap, int k, int* selected) {
+    if (k > heap->size) {
+        k = heap->size;
+    }
+    if (k <= 0) {
+        return 0;
+    }
+    int* candidates = (int*)malloc((size_t)node_candidate_capacity(heap, k) * sizeof(int));
+    if (candidates == NULL) {
+        return -1;
+    }
+    int candidate_count = 1;
+    candidates[0] = 0;
+    for (int chosen = 0; chosen < k; chosen++) {
+        selected[chosen] = pop_node_candidate(heap->nodes, candidates, &candidate_count);
+        push_child_candidates(heap, selected[chosen], candidates, &candidate_count);
+    }
+    free(candidates);
+    return k;
+}
+
+// Extracts up to k highest-priority patients into `out`, in priority order.
+// The k chosen nodes always form a connected group at the top of the tree. They are
+// found with select_top_nodes, their holes are filled with the surviving nodes from
+// the end of the array, and the holes are then sifted down bottom-up (Floyd-style),
+// so the heap is repaired once for the whole batch instead of once per patient.
+// Returns the number of patients extracted, or -1 if scratch memory ran out.
+int extract_min_batch(MinHeap* heap, int k, Patient* out) {
+    if (k > heap->size) {
+        k = heap->size;
+    }
+    if (k <= 0) {
+        return 0;
+    }
+    int* selected = (int*)malloc((size_t)k * sizeof(int));
+    if (selected == NULL || select_top_nodes(heap, k, selected) != k) {
+        free(selected);
+        return -1;
+    }
+    for (int i = 0; i < k; i++) {
+        int slot = heap->nodes[selected[i]].slot;
+        out[i] = heap->patients[slot];
+        id_index_erase(&heap->ids, out[i].patient_id, slot);
+        heap->free_slots[heap->free_count++] = slot;
+    }
+
+    // Holes below the new size are refilled from the tail, skipping nodes that are
+    // themselves being removed.
+    qsort(selected, k, sizeof(int), compare_ints);
+    int new_size = heap->size - k;
+    int hole_count = 0;
+    while (hole_count < k && selected[hole_count] < new_size) {
+        hole_count++;
+    }
+    int removed_in_tail = hole_count;
+    int filler = new_size;
+    for (int h = 0; h < hole_count; h++) {
+        while (removed_in_tail < k && selected[removed_in_tail] == filler) {
+            removed_in_tail++;
+            filler++;
+        }
+        heap->nodes[selected[h]] = heap->nodes[filler++];
+    }
+    heap->size = new_size;
+    for (int h = hole_count - 1; h >= 0; h--) {
+        heapify_down(heap, selected[h]);
+    }
+    free(selected);
+
+    shrink_heap(heap);
+    return k;
+}
+
+// Removes a specific patient from the heap in O(log n).
+// Returns 0 and copies the record into *removed (if not NULL), or -1 if the ID is not waiting.
+int remove_from_heap(MinHeap* heap, int patient_id, Patient* removed) {
+    int slot = id_index_find(&heap->ids, patient_id);
+    if (slot == -1) {
+        return -1;
+    }
+    Patient patient = remove_heap_node(heap, heap->positions[slot]);
+    if (removed != NULL) {
+        *removed = patient;
+    }
+    return 0;
+}
+
+// Changes a waiting patient's priority level in O(log n). The patient keeps their
+// original arrival sequence (and arrival time, for aging), so within the new level
+// they are still ordered by when they first arrived.
+// Returns 0 on success, or -1 if the ID is not waiting.
+int change_heap_priority(MinHeap* heap, int patient_id, int new_priority_level) {
+    int slot = id_index_find(&heap->ids, patient_id);
+    if (slot == -1) {
+        return -1;
+    }
+    int index = heap->positions[slot];
+    uint64_t old_key = heap->nodes[index].key;
+    uint64_t new_key = heap_sort_key(heap, new_priority_level, (uint32_t)old_key, heap->patients[slot].arrival_time);
+    heap->patients[slot].priority_level = new_priority_level;
+    heap->nodes[index].key = new_key;
+    if (new_key < old_key) {
+        heapify_up(heap, index);
+    } else {
+        heapify_down(heap, index);
+    }
+    return 0;
+}
+
+// Returns the FIFO index used for a priority level.
+int bucket_level(int priority_level) {
+    if (priority_level < 0) {
+        return 0;
+    }
+    return priority_level >= BUCKET_LEVELS ? BUCKET_LEVELS - 1 : priority_level;
+}
+
+// Returns the index of the lowest set bit of a non-zero bitmap.
+int lowest_set_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(bits);
+#else
+    int index = 0;
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// Returns the key of a patient arriving at arrival_time (in nanoseconds) under the
+// queue's aging setting.
+// Aged keys use the FIFO's level rather than the patient's own, so keys within one
+// FIFO never decrease from front to back.
+uint64_t bucket_key(const BucketQueue* queue, int priority_level, uint32_t sequence, uint64_t arrival_time) {
+    if (queue->aging_interval == 0) {
+        return make_sort_key(priority_level, sequence);
+    }
+    return make_aged_key(bucket_level(priority_level), sequence, arrival_time / NS_PER_MS, queue->aging_interval);
+}
+
+// Fills in an empty bucket queue whose per-slot arrays (patients, stamps, keys,
+// free_slots, and ID index entries of id_index_bucket_count(capacity) buckets) and
+// arena pointer have already been set by the caller.
+void init_bucket_queue(BucketQueue* queue, int capacity, IdIndexEntry* index_entries) {
+    memset(queue->levels, 0, sizeof(queue->levels));
+    queue->non_empty = 0;
+    queue->free_count = 0;
+    for (int slot = capacity - 1; slot >= 0; slot--) {
+        queue->free_slots[queue->free_count++] = slot;
+        queue->patients[slot].patient_id = -1; // Marks the slot as free.
+        queue->stamps[slot] = 0;
+    }
+    reset_id_index(&queue->ids, index_entries, id_index_bucket_count(capacity));
+    queue->size = 0;
+    queue->capacity = capacity;
+    queue->growth = DEFAULT_GROWTH_POLICY;
+    queue->aging_interval = 0;
+    queue->grows = 0;
+}
+
+// Frees an arena-backed bucket queue's memory that has moved out of its arena, or
+// all of it for a queue that was never in an arena.
+void free_bucket_queue(BucketQueue* queue) {
+    const Arena* arena = queue->arena;
+    for (int level = 0; level < BUCKET_LEVELS; level++) {
+        free(queue->levels[level].entries); // FIFOs always live in malloc memory.
+    }
+    release_block(arena, queue->patients);
+    release_block(arena, queue->stamps);
+    release_block(arena, queue->keys);
+    release_block(arena, queue->free_slots);
+    release_block(arena, queue->ids.entries);
+    release_block(arena, queue);
+}
+
+// Grows the per-slot arrays so at least `required` patients fit, and rebuilds the
+// ID index when it would become more than half full. Returns 0 on success, -1 on failure.
+int grow_bucket_queue(BucketQueue* queue, int required) {
+    if (required <= queue->capacity) {
+        return 0;
+    }
+    int old_capacity = queue->capacity;
+    int new_capacity = grown_capacity(&queue->growth, old_capacity, required);
+    if (resize_array(queue->arena, (void**)&queue->patients, old_capacity, new_capacity, sizeof(Patient)) != 0 ||
+        resize_array(queue->arena, (void**)&queue->stamps, old_capacity, new_capacity, sizeof(uint32_t)) != 0 ||
+        resize_array(queue->arena, (void**)&queue->keys, old_capacity, new_capacity, sizeof(uint64_t)) != 0 ||
+        resize_array(queue->arena, (void**)&queue->free_slots, old_capacity, new_capacity, sizeof(int)) != 0) {
+        return -1;
+    }
+    if (2 * new_capacity > queue->ids.mask + 1) {
+        int buckets = id_index_bucket_count(new_capacity);
+        IdIndexEntry* entries = (IdIndexEntry*)malloc((size_t)buckets * sizeof(IdIndexEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        release_block(queue->arena, queue->ids.entries);
+        reset_id_index(&queue->ids, entries, buckets);
+        for (int slot = 0; slot < old_capacity; slot++) {
+            if (queue->patients[slot].patient_id != -1) {
+                id_index_put(&queue->ids, queue->patients[slot].patient_id, slot);
+            }
+        }
+    }
+    for (int slot = new_capacity - 1; slot >= old_capacity; slot--) {
+        queue->free_slots[queue->free_count++] = slot;
+        queue->patients[slot].patient_id = -1;
+        queue->stamps[slot] = 0;
+    }
+    queue->capacity = new_capacity;
+    ADD_STAT(queue->grows, 1);
+    TRACE_POINT("bucket_queue_grow", -1, new_capacity);
+    return 0;
+}
+
+// Appends an entry for `slot` to the FIFO of its patient's level, giving the slot a
+// fresh stamp so any older entry for it becomes stale. Returns 0 on success, -1 on failure.
+int bucket_push(BucketQueue* queue, int slot) {
+    int level = bucket_level(queue->patients[slot].priority_level);
+    BucketFifo* fifo = &queue->levels[level];
+    if (fifo->count == fifo->capacity) {
+        // Double the ring, unwrapping it so the oldest entry is first again.
+        int new_capacity = fifo->capacity == 0 ? 16 : 2 * fifo->capacity;
+        BucketEntry* entries = (BucketEntry*)malloc((size_t)new_capacity * sizeof(BucketEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        for (int i = 0; i < fifo->count; i++) {
+            entries[i] = fifo->entries[(fifo->head + i) & (fifo->capacity - 1)];
+        }
+        free(fifo->entries);
+        fifo->entries = entries;
+        fifo->head = 0;
+        fifo->capacity = new_capacity;
+    }
+    BucketEntry* entry = &fifo->entries[(fifo->head + fifo->count) & (fifo->capacity - 1)];
+    entry->slot = slot;
+    entry->stamp = ++queue->stamps[slot];
+    fifo->count++;
+    queue->non_empty |= (uint64_t)1 << level;
+    return 0;
+}
+
+// Drops stale entries from the front of a level's FIFO and clears its bitmap bit if
+// nothing is left. Returns the slot at the front, or -1 if the level is empty.
+int bucket_front(BucketQueue* queue, int level) {
+    BucketFifo* fifo = &queue->levels[level];
+    while (fifo->count > 0) {
+        BucketEntry entry = fifo->entries[fifo->head];
+        if (queue->stamps[entry.slot] == entry.stamp) {
+            return entry.slot;
+        }
+        fifo->head = (fifo->head + 1) & (fifo->capacity - 1);
+        fifo->count--;
+    }
+    queue->non_empty &= ~((uint64_t)1 << level);
+    return -1;
+}
+
+// Returns how many patients waiting in a level's FIFO have priority_level or lower,
+// walking its entries and skipping the stale ones. Only the first and last FIFOs
+// hold more than one level, so only they need this.
+int bucket_count_at_or_below(const BucketQueue* queue, int level, int priority_level) {
+    const BucketFifo* fifo = &queue->levels[level];
+    int count = 0;
+    for (int i = 0; i < fifo->count; i++) {
+        BucketEntry entry = fifo->entries[(fifo->head + i) & (fifo->capacity - 1)];
+        count += queue->stamps[entry.slot] == entry.stamp && queue->patients[entry.slot].priority_level <= priority_level;
+    }
+    return count;
+}
+
+// Returns the slot of the patient who should be treated next, or -1 if nobody is waiting.
+// With aging, a less urgent level's front may have waited long enough to win, so the
+// fronts of all non-empty levels are compared: O(BUCKET_LEVELS) at worst.
+int bucket_peek_slot(BucketQueue* queue) {
+    if (queue->aging_interval != 0) {
+        int best = -1;
+        uint64_t levels = queue->non_empty;
+        while (levels != 0) {
+            int slot = bucket_front(queue, lowest_set_bit(levels));
+            levels &= levels - 1;
+            if (slot != -1 && (best == -1 || queue->keys[slot] < queue->keys[best])) {
+                best = slot;
+            }
+        }
+        return best;
+    }
+    while (queue->non_empty != 0) {
+        int slot = bucket_front(queue, lowest_set_bit(queue->non_empty));
+        if (slot != -1) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Takes a patient out of the queue, invalidating any entry still queued for the slot.
+Patient bucket_release_slot(BucketQueue* queue, int slot) {
+    Patient patient = queue->patients[slot];
+    queue->levels[bucket_level(patient.priority_level)].waiting--;
+    id_index_erase(&queue->ids, patient.patient_id, slot);
+    queue->patients[slot].patient_id = -1;
+    queue->stamps[slot]++;
+    queue->free_slots[queue->free_count++] = slot;
+    queue->size--;
+    return patient;
+}
+
+// Adds a patient to the back of their level's FIFO in O(1).
+// Returns 0 on success, or -1 if there was not enough memory.
+int bucket_insert(BucketQueue* queue, Patient patient, uint32_t sequence, uint64_t arrival_time) {
+    if (grow_bucket_queue(queue, queue->size + 1) != 0) {
+        return -1;
+    }
+    int slot = queue->free_slots[queue->free_count - 1];
+    patient.arrival_time = arrival_time;
+    patient.treatment_time = 0;
+    queue->patients[slot] = patient;
+    queue->keys[slot] = bucket_key(queue, patient.priority_level, sequence, arrival_time);
+    if (bucket_push(queue, slot) != 0) {
+        queue->patients[slot].patient_id = -1;
+        return -1;
+    }
+    queue->free_count--;
+    id_index_put(&queue->ids, patient.patient_id, slot);
+    queue->levels[bucket_level(patient.priority_level)].waiting++;
+    queue->size++;
+    return 0;
+}
+
+// Removes and returns the patient who should be treated next (see bucket_peek_slot).
+// The queue must not be empty.
+Patient bucket_extract(BucketQueue* queue) {
+    return bucket_release_slot(queue, bucket_peek_slot(queue));
+}
+
+// Moves a waiting patient to the back of their new level's FIFO in O(1) as if they
+// had arrived with the given sequence at `now` (so, with aging, their wait starts
+// over, although their recorded arrival_time does not change); the old entry is
+// left behind as a stale entry. A patient whose level maps to the same FIFO keeps
+// their place. Returns 0 on success, or -1 if the ID is not waiting or memory ran out.
+int bucket_change_priority(BucketQueue* queue, int patient_id, int new_priority_level, uint32_t sequence, uint64_t now) {
+    int slot = id_index_find(&queue->ids, patient_id);
+    if (slot == -1) {
+        return -1;
+    }
+    int old_priority_level = queue->patients[slot].priority_level;
+    queue->patients[slot].priority_level = new_priority_level;
+    if (bucket_level(old_priority_level) == bucket_level(new_priority_level)) {
+        // Same FIFO: the patient keeps their place (and an aged key stays as it is).
+        if (queue->aging_interval == 0) {
+            queue->keys[slot] = make_sort_key(new_priority_level, (uint32_t)queue->keys[slot]);
+        }
+        return 0;
+    }
+    if (bucket_push(queue, slot) != 0) {
+        queue->patients[slot].priority_level = old_priority_level;
+        return -1;
+    }
+    queue->levels[bucket_level(old_priority_level)].waiting--;
+    queue->levels[bucket_level(new_priority_level)].waiting++;
+    queue->keys[slot] = bucket_key(queue, new_priority_level, sequence, now);
+    return 0;
+}
+
+// Removes a specific patient in O(1). Returns 0 and copies the record into *removed
+// (if not NULL), or -1 if the ID is not waiting.
+int bucket_remove(BucketQueue* queue, int patient_id, Patient* removed) {
+    int slot = id_index_find(&queue->ids, patient_id);
+    if (slot == -1) {
+        return -1;
+    }
+    Patient patient = bucket_release_slot(queue, slot);
+    if (removed != NULL) {
+        *removed = patient;
+    }
+    return 0;
+}
+
+// Bytes of name storage, and hash buckets per patient, carved for a new system.
+#define NAME_BYTES_PER_PATIENT 24
+
+// Returns the text of a name handle.
+const char* name_text(const NamePool* pool, NameHandle handle) {
+    return pool->text + handle;
+}
+
+// FNV-1a hash of the first `length` bytes of a name.
+uint32_t hash_name(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// 64-bit FNV-1a hash of a block of bytes, used to detect damaged snapshots and log records.
+uint64_t hash_bytes(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Places a stored name's handle in the first free bucket of its probe sequence.
+void name_pool_place(NamePool* pool, NameHandle handle) {
+    const char* name = name_text(pool, handle);
+    int bucket = (int)(hash_name(name, strlen(name)) & (uint32_t)pool->bucket_mask);
+    while (pool->buckets[bucket] != EMPTY_NAME_HANDLE) {
+        bucket = (bucket + 1) & pool->bucket_mask;
+    }
+    pool->buckets[bucket] = handle;
+}
+
+// Sets up an empty pool over the given text and bucket arrays (bucket_count must be a power of two).
+void init_name_pool(NamePool* pool, const Arena* arena, char* text, int text_capacity, NameHandle* buckets, int bucket_count) {
+    pool->text = text;
+    pool->text[0] = '\0';
+    pool->used = 1;
+    pool->capacity = text_capacity;
+    pool->buckets = buckets;
+    pool->bucket_mask = bucket_count - 1;
+    pool->count = 0;
+    pool->growth = DEFAULT_GROWTH_POLICY;
+    pool->arena = arena;
+    memset(buckets, 0, (size_t)bucket_count * sizeof(NameHandle));
+}
+
+// Doubles the hash table and re-places every stored name. Returns 0 on success, -1 on failure.
+int grow_name_buckets(NamePool* pool) {
+    int bucket_count = 2 * (pool->bucket_mask + 1);
+    NameHandle* buckets = (NameHandle*)calloc((size_t)bucket_count, sizeof(NameHandle));
+    if (buckets == NULL) {
+        return -1;
+    }
+    release_block(pool->arena, pool->buckets);
+    pool->buckets = buckets;
+    pool->bucket_mask = bucket_count - 1;
+    // Names are stored back to back, so walking the text visits each one once.
+    for (int offset = 1; offset < pool->used; offset += (int)strlen(pool->text + offset) + 1) {
+        name_pool_place(pool, (NameHandle)offset);
+    }
+    return 0;
+}
+
+// Returns the handle for `name`, storing it if it has not been seen before.
+// Names longer than MAX_NAME_LENGTH bytes are cut off, and a NULL or empty name
+// maps to EMPTY_NAME_HANDLE. Returns INVALID_NAME_HANDLE if memory runs out.
+NameHandle intern_pool_name(NamePool* pool, const char* name) {
+    size_t length = 0;
+    while (name != NULL && length < MAX_NAME_LENGTH && name[length] != '\0') {
+        length++;
+    }
+    if (length == 0) {
+        return EMPTY_NAME_HANDLE;
+    }
+    // Keep the table at most half full. If it cannot grow, lookups still work (just
+    // more slowly) as long as at least one bucket stays empty.
+    if (2 * (pool->count + 1) > pool->bucket_mask + 1 && grow_name_buckets(pool) != 0 &&
+        pool->count + 1 > pool->bucket_mask) {
+        return INVALID_NAME_HANDLE;
+    }
+    uint32_t hash = hash_name(name, length);
+    int bucket = (int)(hash & (uint32_t)pool->bucket_mask);
+    while (pool->buckets[bucket] != EMPTY_NAME_HANDLE) {
+        const char* stored = name_text(pool, pool->buckets[bucket]);
+        if (strncmp(stored, name, length) == 0 && stored[length] == '\0') {
+            return pool->buckets[bucket];
+        }
+        bucket = (bucket + 1) & pool->bucket_mask;
+    }
+
+    if (pool->used > INT_MAX - (int)length - 1 ||
+        reserve_capacity(pool->arena, (void**)&pool->text, &pool->capacity, pool->used + (int)length + 1, 1, &pool->growth) != 0) {
+        return INVALID_NAME_HANDLE;
+    }
+    NameHandle handle = (NameHandle)pool->used;
+    memcpy(pool->text + pool->used, name, length);
+    pool->text[pool->used + (int)length] = '\0';
+    pool->used += (int)length + 1;
+    pool->buckets[bucket] = handle;
+    pool->count++;
+    return handle;
+}
+
+// Writes the human-readable text for an event into buffer (always NUL-terminated).
+// Returns the number of characters written, as snprintf does.
+int format_event(const TriageEvent* event, char* buffer, size_t size) {
+    const Patient* p = event->patient;
+    switch (event->type) {
+    case EVENT_PATIENT_ADMITTED:
+        return snprintf(buffer, size, "NEW PATIENT: '%s' added to waiting list with priority %d.\n", event->name, p->priority_level);
+    case EVENT_BATCH_ADMITTED:
+        return snprintf(buffer, size, "NEW PATIENTS: %d added to waiting list (IDs %d-%d).\n", event->count, event->first_id, event->last_id);
+    case EVENT_PATIENT_TREATED:
+        return snprintf(buffer, size, "\nTREATING NEXT PATIENT:\n  ID: %d, Name: %s, Priority: %d\n", p->patient_id, event->name, p->priority_level);
+    case EVENT_BATCH_TREATED:
+        return snprintf(buffer, size, "\nTREATING NEXT %d PATIENTS (IDs %d ... %d).\n", event->count, event->first_id, event->last_id);
+    case EVENT_PRIORITY_UPDATED:
+        return snprintf(buffer, size, "RE-TRIAGE: Patient %d now has priority %d.\n", event->patient_id, event->priority_level);
+    case EVENT_PATIENT_REMOVED:
+        return snprintf(buffer, size, "PATIENT LEFT: '%s' (ID: %d) removed from the waiting list.\n", event->name, p->patient_id);
+    case EVENT_WAITING_LIST_EMPTY:
+        return snprintf(buffer, size, "SYSTEM: No patients in the waiting list to treat.\n");
+    case EVENT_PATIENT_NOT_FOUND:
+        return snprintf(buffer, size, "SYSTEM: Patient %d is not in the waiting list.\n", event->patient_id);
+    case EVENT_OUT_OF_MEMORY:
+        return snprintf(buffer, size, "Error: Out of memory while %s (%d patient(s) affected).\n", event->operation, event->count);
+    case EVENT_IO_ERROR:
+        return snprintf(buffer, size, "Error: I/O failure while %s (%d patient(s) affected).\n", event->operation, event->count);
+    }
+    buffer[0] = '\0';
+    return 0;
+}
+
+// Event sink callback that prints every event to standard output.
+void console_sink_emit(void* context, const TriageEvent* event) {
+    (void)context;
+    char line[256];
+    format_event(event, line, sizeof(line));
+    fputs(line, stdout);
+}
+
+// Returns a sink that prints events to the console, as an interactive desk would want.
+EventSink console_event_sink(void) {
+    EventSink sink = {console_sink_emit, NULL};
+    return sink;
+}
+
+// Returns a sink that discards every event.
+EventSink null_event_sink(void) {
+    EventSink sink = {NULL, NULL};
+    return sink;
+}
+
+// State behind a buffered file sink. Formatted events are collected in memory and
+// written with one fwrite per full buffer, so the hot path never takes the stdio lock.
+typedef struct {
+    FILE* file;
+    char* buffer;
+    size_t used;
+    size_t capacity;
+} FileEventSink;
+
+// Writes any buffered events out to the sink's file.
+void flush_file_event_sink(FileEventSink* sink) {
+    if (sink->used > 0) {
+        fwrite(sink->buffer, 1, sink->used, sink->file);
+        sink->used = 0;
+    }
+    fflush(sink->file);
+}
+
+// Event sink callback that appends an event to the in-memory buffer.
+void file_sink_emit(void* context, const TriageEvent* event) {
+    FileEventSink* sink = (FileEventSink*)context;
+    char line[256];
+    int length = format_event(event, line, sizeof(line));
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length >= sizeof(line)) {
+        length = sizeof(line) - 1; // The line was truncated by snprintf.
+    }
+    if (sink->used + (size_t)length > sink->capacity) {
+        fwrite(sink->buffer, 1, sink->used, sink->file);
+        sink->used = 0;
+    }
+    memcpy(sink->buffer + sink->used, line, (size_t)length);
+    sink->used += (size_t)length;
+}
+
+// Opens a sink that appends events to a file through a buffer of buffer_size bytes.
+// Returns a sink with a NULL emit function if the file or buffer cannot be created.
+EventSink create_file_event_sink(const char* path, size_t buffer_size) {
+    EventSink sink = {NULL, NULL};
+    if (buffer_size < 256) {
+        buffer_size = 256;
+    }
+    FileEventSink* state = (FileEventSink*)malloc(sizeof(FileEventSink));
+    if (state == NULL) {
+        return sink;
+    }
+    state->file = fopen(path, "a");
+    state->buffer = (char*)malloc(buffer_size);
+    if (state->file == NULL || state->buffer == NULL) {
+        if (state->file != NULL) {
+            fclose(state->file);
+        }
+        free(state->buffer);
+        free(state);
+        return sink;
+    }
+    state->used = 0;
+    state->capacity = buffer_size;
+    sink.emit = file_sink_emit;
+    sink.context = state;
+    return sink;
+}
+
+// Flushes and closes a sink created by create_file_event_sink.
+void close_file_event_sink(EventSink sink) {
+    if (sink.emit != file_sink_emit) {
+        return;
+    }
+    FileEventSink* state = (FileEventSink*)sink.context;
+    flush_file_event_sink(state);
+    fclose(state->file);
+    free(state->buffer);
+    free(state);
+}
+
+// Writes `size` bytes to a file descriptor, retrying short writes.
+// Returns 0 on success, or -1 on error.
+int write_fully(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+// Returns 1 if a record file header has the expected magic, version and record size.
+int record_header_matches(const RecordFileHeader* header, const char* magic, uint32_t version, uint32_t record_size) {
+    return memcmp(header->magic, magic, 4) == 0 && header->version == version && header->record_size == record_size;
+}
+
+// Opens (or creates) a file of fixed-size records for appending. A new file gets a
+// header; an existing one must have a matching header, and a partial record left
+// at its end by a crash is cut off. Sets *records to the number of whole records.
+// Returns the file descriptor, or -1 on failure.
+int open_record_file(const char* path, const char* magic, uint32_t version, uint32_t record_size, long long* records) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    RecordFileHeader header;
+    int valid;
+    if (status.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic, 4);
+        header.version = version;
+        header.record_size = record_size;
+        valid = write_fully(fd, &header, sizeof(header)) == 0;
+        *records = 0;
+    } else {
+        valid = status.st_size >= (off_t)sizeof(header) && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                record_header_matches(&header, magic, version, record_size);
+        if (valid) {
+            *records = (long long)((status.st_size - (off_t)sizeof(header)) / (off_t)record_size);
+            off_t whole = (off_t)sizeof(header) + (off_t)*records * (off_t)record_size;
+            valid = whole == status.st_size || ftruncate(fd, whole) == 0;
+        }
+    }
+    if (!valid) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Opens (or creates) a journal file for appending, with a buffer of buffer_records
+// records and an fsync after every sync_every buffer writes (0 never syncs
+// explicitly). An existing file must have a matching header; a partial record left
+// at its end by a crash is cut off. Returns NULL on failure.
+TreatedJournal* open_treated_journal(const char* path, int buffer_records, int sync_every) {
+    if (buffer_records < 1) {
+        buffer_records = 1;
+    }
+    TreatedJournal* journal = (TreatedJournal*)malloc(sizeof(TreatedJournal));
+    if (journal == NULL) {
+        return NULL;
+    }
+    journal->buffer = (TreatedJournalRecord*)malloc((size_t)buffer_records * sizeof(TreatedJournalRecord));
+    journal->fd = -1;
+    if (journal->buffer != NULL) {
+        journal->fd = open_record_file(path, "TRJ", TREATED_JOURNAL_VERSION, sizeof(TreatedJournalRecord), &journal->records);
+    }
+    if (journal->fd < 0) {
+        free(journal->buffer);
+        free(journal);
+        return NULL;
+    }
+    journal->used = 0;
+    journal->capacity = buffer_records;
+    journal->sync_every = sync_every < 0 ? 0 : sync_every;
+    journal->unsynced_writes = 0;
+    journal->torn = 0;
+    return journal;
+}
+
+// Writes the buffered records to the file, followed by an fsync if this write
+// completes a group of sync_every. On failure the records stay buffered and a
+// later flush writes them again from the last whole record in the file.
+// Returns 0 on success, or -1 on an I/O error.
+int flush_treated_journal(TreatedJournal* journal) {
+    if (journal->used == 0) {
+        return 0;
+    }
+    // Cut off whatever part of the buffer a failed write left, so the retry starts
+    // on a record boundary.
+    off_t written = (off_t)sizeof(RecordFileHeader) + (off_t)(journal->records - journal->used) * (off_t)sizeof(TreatedJournalRecord);
+    if (journal->torn && ftruncate(journal->fd, written) != 0) {
+        return -1;
+    }
+    journal->torn = 0;
+    if (write_fully(journal->fd, journal->buffer, (size_t)journal->used * sizeof(TreatedJournalRecord)) != 0) {
+        journal->torn = 1;
+        return -1;
+    }
+    journal->used = 0;
+    journal->unsynced_writes++;
+    if (journal->sync_every > 0 && journal->unsynced_writes >= journal->sync_every) {
+        if (fsync(journal->fd) != 0) {
+            return -1;
+        }
+        journal->unsynced_writes = 0;
+    }
+    return 0;
+}
+
+// Flushes, syncs and closes a journal. The system it was attached to must be freed
+// first or detached with attach_treated_journal(system, NULL, 0).
+// Returns 0 on success, or -1 if the last records could not be written.
+int close_treated_journal(TreatedJournal* journal) {
+    int result = flush_treated_journal(journal);
+    if (fsync(journal->fd) != 0) {
+        result = -1;
+    }
+    close(journal->fd);
+    free(journal->buffer);
+    free(journal);
+    return result;
+}
+
+// Reads up to max_records records, starting with record number first_record, from
+// a journal file into `out`. Returns the number of records read, or -1 if the file
+// cannot be opened or is not a journal.
+int read_treated_journal(const char* path, long long first_record, TreatedJournalRecord* out, int max_records) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    RecordFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        !record_header_matches(&header, "TRJ", TREATED_JOURNAL_VERSION, sizeof(TreatedJournalRecord))) {
+        fclose(file);
+        return -1;
+    }
+    int count = 0;
+    if (first_record >= 0 && max_records > 0 &&
+        fseeko(file, (off_t)sizeof(header) + (off_t)first_record * (off_t)sizeof(TreatedJournalRecord), SEEK_SET) == 0) {
+        count = (int)fread(out, sizeof(TreatedJournalRecord), (size_t)max_records, file);
+    }
+    fclose(file);
+    return count;
+}
+
+// Returns the checksum of a write-ahead log record.
+uint64_t wal_record_checksum(const WalRecord* record) {
+    WalRecord copy = *record;
+    copy.checksum = 0;
+    return hash_bytes(&copy, sizeof(copy));
+}
+
+// Reads the next record of a write-ahead log file. Returns 1 if it is whole, has a
+// valid checksum and follows previous_lsn (0 accepts any LSN), or 0 at the end of
+// the valid log.
+int read_wal_record(FILE* file, uint64_t previous_lsn, WalRecord* record) {
+    return fread(record, sizeof(*record), 1, file) == 1 && record->checksum == wal_record_checksum(record) &&
+           (previous_lsn == 0 || record->lsn == previous_lsn + 1);
+}
+
+// Opens (or creates) a write-ahead log for appending, with room for buffer_records
+// records between commits. Records after the last valid one (torn by a crash) are
+// cut off, and numbering continues after the last valid LSN. Returns NULL on failure.
+WriteAheadLog* open_write_ahead_log(const char* path, int buffer_records) {
+    if (buffer_records < 1) {
+        buffer_records = 1;
+    }
+    long long records = 0;
+    int fd = open_record_file(path, "TRW", WAL_VERSION, sizeof(WalRecord), &records);
+    if (fd < 0) {
+        return NULL;
+    }
+    // Find the end of the valid records.
+    uint64_t last_lsn = 0;
+    long long valid = 0;
+    FILE* file = fopen(path, "rb");
+    if (file != NULL && fseeko(file, (off_t)sizeof(RecordFileHeader), SEEK_SET) == 0) {
+        WalRecord record;
+        while (valid < records && read_wal_record(file, last_lsn, &record)) {
+            last_lsn = record.lsn;
+            valid++;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    WriteAheadLog* wal = (WriteAheadLog*)malloc(sizeof(WriteAheadLog));
+    WalRecord* buffer = (WalRecord*)malloc((size_t)buffer_records * sizeof(WalRecord));
+    if (file == NULL || wal == NULL || buffer == NULL ||
+        (valid < records && ftruncate(fd, (off_t)sizeof(RecordFileHeader) + (off_t)valid * (off_t)sizeof(WalRecord)) != 0)) {
+        free(wal);
+        free(buffer);
+        close(fd);
+        return NULL;
+    }
+    wal->fd = fd;
+    wal->buffer = buffer;
+    wal->used = 0;
+    wal->capacity = buffer_records;
+    wal->next_lsn = last_lsn + 1;
+    wal->durable_lsn = last_lsn;
+    wal->file_records = valid;
+    wal->torn = 0;
+    wal->failed = 0;
+    return wal;
+}
+
+// Writes every buffered record and waits until they are on disk: one group commit.
+// If a write fails the records stay buffered, and whatever part of them reached the
+// file is cut off before the next attempt. A failed sync cannot be retried: the
+// kernel may already have dropped the pages it could not write, so a second sync
+// could succeed without them. The log is then failed for good, and this call,
+// reset_write_ahead_log and checkpoints all return -1 from then on; the records
+// written since the last good sync must be treated as lost.
+// Returns 0 on success, or -1 on an I/O error.
+int commit_write_ahead_log(WriteAheadLog* wal) {
+    if (wal->failed) {
+        return -1;
+    }
+    if (wal->used > 0) {
+        if (wal->torn &&
+            ftruncate(wal->fd, (off_t)sizeof(RecordFileHeader) + (off_t)wal->file_records * (off_t)sizeof(WalRecord)) != 0) {
+            return -1;
+        }
+        wal->torn = 0;
+        if (write_fully(wal->fd, wal->buffer, (size_t)wal->used * sizeof(WalRecord)) != 0) {
+            wal->torn = 1;
+            return -1;
+        }
+        wal->file_records += wal->used;
+        wal->used = 0;
+    }
+    if (wal->durable_lsn == wal->next_lsn - 1) {
+        return 0;
+    }
+    if (fdatasync(wal->fd) != 0) {
+        wal->failed = 1;
+        return -1;
+    }
+    wal->durable_lsn = wal->next_lsn - 1;
+    return 0;
+}
+
+// Empties the log file after a checkpoint. LSNs keep counting up, so a snapshot
+// taken before the reset still knows which records it already contains.
+// Returns 0 on success, or -1 on an I/O error.
+int reset_write_ahead_log(WriteAheadLog* wal) {
+    if (commit_write_ahead_log(wal) != 0 || ftruncate(wal->fd, (off_t)sizeof(RecordFileHeader)) != 0) {
+        return -1;
+    }
+    wal->file_records = 0;
+    if (fsync(wal->fd) != 0) {
+        wal->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+// Commits and closes a write-ahead log. The system it was attached to must be
+// freed first or detached with attach_write_ahead_log(system, NULL).
+// Returns 0 on success, or -1 if the last records could not be committed.
+int close_write_ahead_log(WriteAheadLog* wal) {
+    int result = commit_write_ahead_log(wal);
+    close(wal->fd);
+    free(wal->buffer);
+    free(wal);
+    return result;
+}
+
+// Reports an event to the system's sink, if it has one.
+void emit_event(TriageSystem* system, const TriageEvent* event) {
+    if (system->events.emit != NULL) {
+        system->events.emit(system->events.context, event);
+    }
+}
+
+// Reports an event that concerns a single patient record.
+void emit_patient_event(TriageSystem* system, TriageEventType type, const Patient* patient) {
+    if (system->events.emit != NULL) {
+        TriageEvent event = {type, patient, name_text(&system->names, patient->name), patient->patient_id,
+                             patient->priority_level, 1, patient->patient_id, patient->patient_id, NULL};
+        system->events.emit(system->events.context, &event);
+    }
+}
+
+// Reports an event that only carries an ID, priority, count or operation name.
+void emit_simple_event(TriageSystem* system, TriageEventType type, int patient_id, int count, const char* operation) {
+    if (system->events.emit != NULL) {
+        TriageEvent event = {type, NULL, NULL, patient_id, 0, count, 0, 0, operation};
+        system->events.emit(system->events.context, &event);
+    }
+}
+
+// Returns a monotonic timestamp in nanoseconds, used for benchmarking and as the
+// default triage clock.
+uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// TriageClock callback that reads CLOCK_MONOTONIC.
+uint64_t monotonic_clock_now(void* context) {
+    (void)context;
+    return monotonic_ns();
+}
+
+// Returns the default clock, backed by CLOCK_MONOTONIC.
+TriageClock monotonic_clock(void) {
+    TriageClock clock = {monotonic_clock_now, NULL};
+    return clock;
+}
+
+// Returns the histogram bucket that counts a wait of `value` milliseconds. Values
+// below 2^WAIT_HISTOGRAM_SUB_BITS have a bucket each; above that, the top
+// WAIT_HISTOGRAM_SUB_BITS bits of the value pick the bucket.
+int wait_bucket_index(uint64_t value) {
+    if (value > UINT32_MAX) {
+        value = UINT32_MAX;
+    }
+    if (value < (1u << WAIT_HISTOGRAM_SUB_BITS)) {
+        return (int)value;
+    }
+    int top_bit = 0;
+    while ((value >> top_bit) > 1) {
+        top_bit++;
+    }
+    int shift = top_bit - (WAIT_HISTOGRAM_SUB_BITS - 1);
+    return (shift << (WAIT_HISTOGRAM_SUB_BITS - 1)) + (int)(value >> shift);
+}
+
+// Returns the largest wait in milliseconds that falls in a histogram bucket.
+uint64_t wait_bucket_highest(int index) {
+    int half = 1 << (WAIT_HISTOGRAM_SUB_BITS - 1);
+    if (index < 2 * half) {
+        return (uint64_t)index;
+    }
+    int shift = index / half - 1;
+    uint64_t lowest = (uint64_t)(index % half + half) << shift;
+    return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+// Returns the histogram index used for a priority level.
+int wait_histogram_level(int priority_level) {
+    if (priority_level < 0) {
+        return 0;
+    }
+    return priority_level >= WAIT_HISTOGRAM_LEVELS ? WAIT_HISTOGRAM_LEVELS - 1 : priority_level;
+}
+
+// Adds one value to a histogram.
+void add_histogram_value(WaitHistogram* histogram, uint64_t value) {
+    histogram->count++;
+    histogram->total += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->buckets[wait_bucket_index(value)]++;
+}
+
+// Adds one treated patient's door-to-treatment time to a histogram.
+void record_wait_time(WaitHistogram* histogram, const Patient* patient) {
+    add_histogram_value(histogram, (patient->treatment_time - patient->arrival_time) / NS_PER_MS);
+}
+
+// Returns the wait in milliseconds that `percentile` percent of the histogram's
+// patients did not exceed, at the histogram's resolution. The cost depends only on
+// WAIT_HISTOGRAM_BUCKETS, not on how many patients were treated.
+uint64_t wait_histogram_percentile(const WaitHistogram* histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < WAIT_HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t highest = wait_bucket_highest(i);
+            return highest < histogram->max ? highest : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+// Carves a d-ary heap waiting list and its initial arrays, and initializes it once
+// everything fits. Returns NULL if the arena is too small or only measuring.
+MinHeap* carve_heap(Arena* arena, const Arena* owner, int initial_capacity, int arity) {
+    size_t capacity = (size_t)initial_capacity;
+    int buckets = id_index_bucket_count(initial_capacity);
+    MinHeap* heap = (MinHeap*)arena_alloc(arena, sizeof(MinHeap), ARENA_ALIGNMENT);
+    void* node_block = arena_alloc(arena, node_block_bytes(initial_capacity), CACHE_LINE_SIZE);
+    Patient* patients = (Patient*)arena_alloc(arena, capacity * sizeof(Patient), ARENA_ALIGNMENT);
+    int* free_slots = (int*)arena_alloc(arena, capacity * sizeof(int), ARENA_ALIGNMENT);
+    int* positions = (int*)arena_alloc(arena, capacity * sizeof(int), ARENA_ALIGNMENT);
+    IdIndexEntry* id_index = (IdIndexEntry*)arena_alloc(arena, (size_t)buckets * sizeof(IdIndexEntry), ARENA_ALIGNMENT);
+    if (heap == NULL || node_block == NULL || patients == NULL || free_slots == NULL || positions == NULL ||
+        id_index == NULL) {
+        return NULL;
+    }
+    heap->arena = owner;
+    heap->node_block = node_block;
+    heap->nodes = (HeapNode*)node_block + NODE_ARRAY_OFFSET;
+    heap->patients = patients;
+    heap->free_slots = free_slots;
+    heap->positions = positions;
+    heap->ids.entries = id_index;
+    init_heap(heap, initial_capacity, arity);
+    return heap;
+}
+
+// Carves a bucket queue waiting list and its initial per-slot arrays, and initializes
+// it once everything fits. Returns NULL if the arena is too small or only measuring.
+BucketQueue* carve_bucket_queue(Arena* arena, const Arena* owner, int initial_capacity) {
+    size_t capacity = (size_t)initial_capacity;
+    int buckets = id_index_bucket_count(initial_capacity);
+    BucketQueue* queue = (BucketQueue*)arena_alloc(arena, sizeof(BucketQueue), ARENA_ALIGNMENT);
+    Patient* patients = (Patient*)arena_alloc(arena, capacity * sizeof(Patient), ARENA_ALIGNMENT);
+    uint32_t* stamps = (uint32_t*)arena_alloc(arena, capacity * sizeof(uint32_t), ARENA_ALIGNMENT);
+    uint64_t* keys = (uint64_t*)arena_alloc(arena, capacity * sizeof(uint64_t), ARENA_ALIGNMENT);
+    int* free_slots = (int*)arena_alloc(arena, capacity * sizeof(int), ARENA_ALIGNMENT);
+    IdIndexEntry* id_index = (IdIndexEntry*)arena_alloc(arena, (size_t)buckets * sizeof(IdIndexEntry), ARENA_ALIGNMENT);
+    if (queue == NULL || patients == NULL || stamps == NULL || keys == NULL || free_slots == NULL ||
+        id_index == NULL) {
+        return NULL;
+    }
+    queue->arena = owner;
+    queue->patients = patients;
+    queue->stamps = stamps;
+    queue->keys = keys;
+    queue->free_slots = free_slots;
+    init_bucket_queue(queue, initial_capacity, id_index);
+    return queue;
+}
+
+// Reassembles record `index` of a set of treated log columns.
+Patient load_treated_columns(const TreatedColumns* columns, int index) {
+    Patient patient;
+    patient.name = columns->names[index];
+    patient.priority_level = columns->priority_levels[index];
+    patient.patient_id = columns->patient_ids[index];
+    patient.arrival_time = columns->arrival_times[index];
+    patient.treatment_time = columns->treatment_times[index];
+    return patient;
+}
+
+// Stores a patient as record `index` of a set of treated log columns.
+void store_treated_columns(TreatedColumns* columns, int index, const Patient* patient) {
+    columns->names[index] = patient->name;
+    columns->priority_levels[index] = patient->priority_level;
+    columns->patient_ids[index] = patient->patient_id;
+    columns->arrival_times[index] = patient->arrival_time;
+    columns->treatment_times[index] = patient->treatment_time;
+}
+
+// Resizes every column from old_capacity to new_capacity records (see
+// resize_array). Returns 0 on success, or -1 if memory runs out, in which case some
+// columns may already have the new size, which is harmless.
+int resize_treated_columns(const Arena* arena, TreatedColumns* columns, int old_capacity, int new_capacity) {
+    if (resize_array(arena, (void**)&columns->patient_ids, old_capacity, new_capacity, sizeof(int)) != 0 ||
+        resize_array(arena, (void**)&columns->priority_levels, old_capacity, new_capacity, sizeof(int)) != 0 ||
+        resize_array(arena, (void**)&columns->arrival_times, old_capacity, new_capacity, sizeof(uint64_t)) != 0 ||
+        resize_array(arena, (void**)&columns->treatment_times, old_capacity, new_capacity, sizeof(uint64_t)) != 0 ||
+        resize_array(arena, (void**)&columns->names, old_capacity, new_capacity, sizeof(NameHandle)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Frees the columns that are not in the arena.
+void release_treated_columns(const Arena* arena, TreatedColumns* columns) {
+    release_block(arena, columns->patient_ids);
+    release_block(arena, columns->priority_levels);
+    release_block(arena, columns->arrival_times);
+    release_block(arena, columns->treatment_times);
+    release_block(arena, columns->names);
+}
+
+// Carves a complete triage system out of the arena: the system and log structs, the
+// chosen waiting list engine, and every initial array, laid out back to back.
+// Returns NULL if the arena is too small, or always when the arena is only measuring
+// (see arena_alloc).
+TriageSystem* carve_triage_system(Arena* arena, int initial_capacity, WaitingListEngine engine, int arity) {
+    size_t capacity = (size_t)initial_capacity;
+    int buckets = id_index_bucket_count(initial_capacity);
+    TriageSystem* system = (TriageSystem*)arena_alloc(arena, sizeof(TriageSystem), ARENA_ALIGNMENT);
+    TreatedLog* log = (TreatedLog*)arena_alloc(arena, sizeof(TreatedLog), ARENA_ALIGNMENT);
+    TreatedColumns log_columns;
+    log_columns.patient_ids = (int*)arena_alloc(arena, capacity * sizeof(int), ARENA_ALIGNMENT);
+    log_columns.priority_levels = (int*)arena_alloc(arena, capacity * sizeof(int), ARENA_ALIGNMENT);
+    log_columns.arrival_times = (uint64_t*)arena_alloc(arena, capacity * sizeof(uint64_t), ARENA_ALIGNMENT);
+    log_columns.treatment_times = (uint64_t*)arena_alloc(arena, capacity * sizeof(uint64_t), ARENA_ALIGNMENT);
+    log_columns.names = (NameHandle*)arena_alloc(arena, capacity * sizeof(NameHandle), ARENA_ALIGNMENT);
+    char* names_text = (char*)arena_alloc(arena, capacity * NAME_BYTES_PER_PATIENT, 1);
+    NameHandle* name_buckets = (NameHandle*)arena_alloc(arena, (size_t)buckets * sizeof(NameHandle), ARENA_ALIGNMENT);
+    // The waiting list records where the system's arena will live; it is only
+    // dereferenced after the copy below.
+    const Arena* owner = system == NULL ? NULL : &system->arena;
+    MinHeap* heap = NULL;
+    BucketQueue* bucket_list = NULL;
+    if (engine == ENGINE_BUCKET_QUEUE) {
+        bucket_list = carve_bucket_queue(arena, owner, initial_capacity);
+    } else {
+        heap = carve_heap(arena, owner, initial_capacity, arity);
+    }
+    if (system == NULL || log == NULL || log_columns.patient_ids == NULL || log_columns.priority_levels == NULL ||
+        log_columns.arrival_times == NULL || log_columns.treatment_times == NULL || log_columns.names == NULL ||
+        names_text == NULL || name_buckets == NULL ||
+        (heap == NULL && bucket_list == NULL)) {
+        return NULL;
+    }
+
+    system->arena = *arena;
+
+    log->arena = &system->arena;
+    log->columns = log_columns;
+    log->size = 0;
+    log->capacity = initial_capacity;
+    log->growth = DEFAULT_GROWTH_POLICY;
+    log->head = 0;
+    log->tail_limit = 0;
+    log->total = 0;
+    log->journal = NULL;
+    log->grows = 0;
+    memset(&log->ids, 0, sizeof(log->ids));
+    memset(log->levels, 0, sizeof(log->levels));
+
+    init_name_pool(&system->names, &system->arena, names_text, initial_capacity * NAME_BYTES_PER_PATIENT, name_buckets, buckets);
+
+    system->engine = engine == ENGINE_BUCKET_QUEUE ? ENGINE_BUCKET_QUEUE : ENGINE_HEAP;
+    system->waiting_list = heap;
+    system->bucket_list = bucket_list;
+    system->treated_log = log;
+    system->next_patient_id = 1;
+    system->next_sequence = 0;
+    system->clock = monotonic_clock();
+    system->epoch_ns = system->clock.now_ns(system->clock.context);
+    system->wait_histograms = NULL;
+    system->wal = NULL;
+    system->applied_lsn = 0;
+    system->changes = NULL;
+    system->shared_keys = 0;
+    memset(&system->stats, 0, sizeof(system->stats));
+    system->events = null_event_sink();
+    return system;
+}
+
+// Returns how many bytes of memory create_triage_system_in_arena needs for a system
+// with the given initial capacity, engine and heap arity. The figure includes slack
+// for a buffer that does not start on a cache line.
+size_t triage_arena_size(int initial_capacity, WaitingListEngine engine, int arity) {
+    if (initial_capacity < 1) {
+        initial_capacity = 1;
+    }
+    Arena measure = {NULL, SIZE_MAX, 0, 0};
+    carve_triage_system(&measure, initial_capacity, engine, arity);
+    return measure.used + CACHE_LINE_SIZE;
+}
+
+// Builds a triage system entirely inside caller-supplied memory, so many
+// per-department instances can be set up without any allocator calls. Arrays that
+// later outgrow their initial capacity move to malloc memory; free_triage_system
+// frees those, while the buffer itself stays owned by the caller. `arity` is only
+// used by ENGINE_HEAP. Returns NULL if `size` is smaller than
+// triage_arena_size(initial_capacity, engine, arity).
+TriageSystem* create_triage_system_in_arena(void* memory, size_t size, int initial_capacity, WaitingListEngine engine, int arity) {
+    if (initial_capacity < 1) {
+        initial_capacity = 1;
+    }
+    Arena arena = {(char*)memory, size, 0, 0};
+    return carve_triage_system(&arena, initial_capacity, engine, arity);
+}
+
+// Initializes the entire triage system with the chosen waiting list engine.
+// ENGINE_BUCKET_QUEUE suits small integer triage scales (levels 0 to BUCKET_LEVELS - 1)
+// and ENGINE_HEAP any priority range; `arity` is only used by ENGINE_HEAP.
+// Everything is carved from a single allocation that is released by free_triage_system.
+// The system starts quiet; call set_event_sink to see what it does.
+TriageSystem* create_triage_system_with_engine(int initial_capacity, WaitingListEngine engine, int arity) {
+    size_t size = triage_arena_size(initial_capacity, engine, arity);
+    void* memory = malloc(size);
+    if (memory == NULL) {
+        return NULL;
+    }
+    TriageSystem* system = create_triage_system_in_arena(memory, size, initial_capacity, engine, arity);
+    system->arena.owned = 1;
+    return system;
+}
+
+// Initializes the entire triage system with a heap waiting list of the given arity.
+TriageSystem* create_triage_system_with_arity(int initial_capacity, int arity) {
+    return create_triage_system_with_engine(initial_capacity, ENGINE_HEAP, arity);
+}
+
+// Initializes the entire triage system with a binary-heap waiting list.
+TriageSystem* create_triage_system(int initial_capacity) {
+    return create_triage_system_with_arity(initial_capacity, MIN_HEAP_ARITY);
+}
+
+// Chooses where the system reports its events (see console_event_sink,
+// create_file_event_sink and null_event_sink).
+void set_event_sink(TriageSystem* system, EventSink sink) {
+    system->events = sink;
+}
+
+// Changes how the waiting list and treated log grow and shrink.
+// Existing arrays keep their current capacity until the next resize.
+void set_growth_policy(TriageSystem* system, GrowthPolicy policy) {
+    policy = sanitize_growth_policy(policy);
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        system->bucket_list->growth = policy; // The bucket queue only grows.
+    } else {
+        system->waiting_list->growth = policy;
+    }
+    system->treated_log->growth = policy;
+    system->names.growth = policy;
+}
+
+// Replaces the system's clock and restarts its arrival times from the new clock's
+// current reading. Call this before admitting patients if aging is on.
+void set_triage_clock(TriageSystem* system, TriageClock clock) {
+    system->clock = clock;
+    system->epoch_ns = clock.now_ns(clock.context);
+}
+
+// Returns the nanoseconds elapsed on the system's clock since it started, the time
+// base of Patient.arrival_time and treatment_time.
+uint64_t triage_now(const TriageSystem* system) {
+    return system->clock.now_ns(system->clock.context) - system->epoch_ns;
+}
+
+// Frees all dynamically allocated memory to prevent memory leaks. Arrays that grew out
+// of the arena are freed one by one; the arena itself goes with a single free (or is
+// left to the caller if they supplied it). The event sink is not closed here.
+void free_triage_system(TriageSystem* system) {
+    Arena arena = system->arena; // The system struct itself may live in the arena.
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        free_bucket_queue(system->bucket_list);
+    } else {
+        free_heap(system->waiting_list);
+    }
+    free(system->treated_log->ids.entries);
+    for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+        free(system->treated_log->levels[level].records);
+    }
+    release_treated_columns(&arena, &system->treated_log->columns);
+    release_block(&arena, system->treated_log);
+    release_block(&arena, system->names.text);
+    release_block(&arena, system->names.buckets);
+    free(system->wait_histograms);
+    if (system->changes != NULL) {
+        free(system->changes->records);
+        free(system->changes);
+    }
+    release_block(&arena, system);
+    if (arena.owned) {
+        free(arena.base);
+    }
+}
+
+// Stores a patient name in the system's name pool and returns its handle, for
+// filling in Patient.name before calling add_patients_bulk. Names longer than
+// MAX_NAME_LENGTH bytes are cut off. Returns INVALID_NAME_HANDLE if memory runs out.
+NameHandle intern_name(TriageSystem* system, const char* name) {
+    return intern_pool_name(&system->names, name);
+}
+
+// Returns the name of a patient record that belongs to this system.
+const char* patient_name(const TriageSystem* system, const Patient* patient) {
+    return name_text(&system->names, patient->name);
+}
+
+// The waiting_* functions below hide which engine holds the waiting list.
+
+// Returns the number of patients waiting.
+int waiting_count(const TriageSystem* system) {
+    return system->engine == ENGINE_BUCKET_QUEUE ? system->bucket_list->size : system->waiting_list->size;
+}
+
+// Returns 1 if a patient with this ID is waiting, or 0 otherwise.
+int waiting_contains(const TriageSystem* system, int patient_id) {
+    const IdIndex* ids = system->engine == ENGINE_BUCKET_QUEUE ? &system->bucket_list->ids : &system->waiting_list->ids;
+    return id_index_find(ids, patient_id) != -1;
+}
+
+// Puts one patient on the waiting list. Returns 0 on success, -1 on failure.
+int waiting_insert(TriageSystem* system, Patient patient, uint32_t sequence, uint64_t arrival_time) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        return bucket_insert(system->bucket_list, patient, sequence, arrival_time);
+    }
+    return insert_patient_with_sequence(system->waiting_list, patient, sequence, arrival_time);
+}
+
+// Puts a batch of patients on the waiting list with consecutive IDs and sequences.
+// Either the whole batch is added or none of it. Returns 0 on success, -1 on failure.
+int waiting_append(TriageSystem* system, const Patient* patients, int count, int first_id, uint32_t first_sequence,
+                   uint64_t arrival_time) {
+    if (system->engine != ENGINE_BUCKET_QUEUE) {
+        return append_patients_to_heap(system->waiting_list, patients, count, first_id, first_sequence, arrival_time);
+    }
+    BucketQueue* queue = system->bucket_list;
+    if (count > INT_MAX - queue->size || grow_bucket_queue(queue, queue->size + count) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        Patient patient = {patients[i].name, patients[i].priority_level, first_id + i, 0, 0};
+        if (bucket_insert(queue, patient, first_sequence + (uint32_t)i, arrival_time) != 0) {
+            while (--i >= 0) {
+                bucket_remove(queue, first_id + i, NULL);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Returns the patient who should be treated next, or NULL if nobody is waiting.
+const Patient* waiting_peek(TriageSystem* system) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        int slot = bucket_peek_slot(system->bucket_list);
+        return slot == -1 ? NULL : &system->bucket_list->patients[slot];
+    }
+    return system->waiting_list->size == 0 ? NULL : peek_min(system->waiting_list);
+}
+
+// Returns the sort key (see make_sort_key) of the patient who should be treated
+// next, or UINT64_MAX if nobody is waiting.
+uint64_t waiting_top_key(TriageSystem* system) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        BucketQueue* queue = system->bucket_list;
+        int slot = bucket_peek_slot(queue);
+        return slot == -1 ? UINT64_MAX : queue->keys[slot];
+    }
+    return system->waiting_list->size == 0 ? UINT64_MAX : system->waiting_list->nodes[0].key;
+}
+
+// Removes and returns the patient who should be treated next. The list must not be empty.
+Patient waiting_extract(TriageSystem* system) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        return bucket_extract(system->bucket_list);
+    }
+    return extract_min(system->waiting_list);
+}
+
+// Removes the k patients who should be treated next (k must not exceed the number
+// waiting) into `out` in treatment order. Returns k, or -1 if memory ran out.
+int waiting_extract_batch(TriageSystem* system, int k, Patient out[]) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        for (int i = 0; i < k; i++) {
+            out[i] = bucket_extract(system->bucket_list);
+        }
+        return k;
+    }
+    return extract_min_batch(system->waiting_list, k, out);
+}
+
+// Re-triages a waiting patient. The heap keeps the patient's original place in
+// arrival order; the bucket queue moves them to the back of their new level as if
+// they arrived with `sequence` at time `now`, restarting their aging. Returns 0 on
+// success, -1 on failure.
+int waiting_change_priority(TriageSystem* system, int patient_id, int new_priority_level, uint32_t sequence, uint64_t now) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        return bucket_change_priority(system->bucket_list, patient_id, new_priority_level, sequence, now);
+    }
+    return change_heap_priority(system->waiting_list, patient_id, new_priority_level);
+}
+
+// Removes a specific waiting patient into *removed (if not NULL).
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int waiting_remove(TriageSystem* system, int patient_id, Patient* removed) {
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        return bucket_remove(system->bucket_list, patient_id, removed);
+    }
+    return remove_from_heap(system->waiting_list, patient_id, removed);
+}
+
+// Starts walking the first k waiting patients in treatment order (all of them if k
+// is 0 or more than are waiting) without extracting, copying or reordering
+// anything. The heap engine follows select_top_nodes, popping from a candidate heap
+// of node indexes, so the walk costs O(k log k) whatever the list's size; the
+// bucket engine reads its FIFOs from the front, skipping stale entries.
+// The list must not change until close_waiting_list_iterator.
+// Returns 0 on success, or -1 if the candidate buffer could not be allocated.
+int open_waiting_list_iterator(const TriageSystem* system, int k, WaitingListIterator* iterator) {
+    memset(iterator, 0, sizeof(*iterator));
+    iterator->system = system;
+    int waiting = waiting_count(system);
+    iterator->remaining = k <= 0 || k > waiting ? waiting : k;
+    if (system->engine == ENGINE_BUCKET_QUEUE || iterator->remaining == 0) {
+        return 0;
+    }
+    const MinHeap* heap = system->waiting_list;
+    iterator->candidates = (int*)malloc((size_t)node_candidate_capacity(heap, iterator->remaining) * sizeof(int));
+    if (iterator->candidates == NULL) {
+        iterator->remaining = 0;
+        return -1;
+    }
+    iterator->candidates[0] = 0;
+    iterator->candidate_count = 1;
+    return 0;
+}
+
+// Returns the slot of the first live entry at or after the iterator's position in a
+// bucket FIFO, advancing the position past stale entries, or -1 if none is left.
+int bucket_iterator_front(const BucketQueue* queue, WaitingListIterator* iterator, int level) {
+    const BucketFifo* fifo = &queue->levels[level];
+    while (iterator->positions[level] < fifo->count) {
+        BucketEntry entry = fifo->entries[(fifo->head + iterator->positions[level]) & (fifo->capacity - 1)];
+        if (queue->stamps[entry.slot] == entry.stamp) {
+            return entry.slot;
+        }
+        iterator->positions[level]++;
+    }
+    return -1;
+}
+
+// Returns the next waiting patient in treatment order, or NULL once k patients (or
+// everyone waiting) have been returned. The record stays owned by the waiting list.
+const Patient* next_waiting_patient(WaitingListIterator* iterator) {
+    if (iterator->remaining <= 0) {
+        return NULL;
+    }
+    iterator->remaining--;
+    const TriageSystem* system = iterator->system;
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        // The same choice as bucket_peek_slot: the first non-empty level, or with
+        // aging the smallest key among the level fronts.
+        const BucketQueue* queue = system->bucket_list;
+        int best = -1;
+        int best_level = 0;
+        for (uint64_t levels = queue->non_empty; levels != 0; levels &= levels - 1) {
+            int level = lowest_set_bit(levels);
+            int slot = bucket_iterator_front(queue, iterator, level);
+            if (slot != -1 && (best == -1 || queue->keys[slot] < queue->keys[best])) {
+                best = slot;
+                best_level = level;
+                if (queue->aging_interval == 0) {
+                    break;
+                }
+            }
+        }
+        iterator->positions[best_level]++;
+        return &queue->patients[best];
+    }
+    const MinHeap* heap = system->waiting_list;
+    int index = pop_node_candidate(heap->nodes, iterator->candidates, &iterator->candidate_count);
+    if (iterator->remaining > 0) {
+        push_child_candidates(heap, index, iterator->candidates, &iterator->candidate_count);
+    }
+    return &heap->patients[heap->nodes[index].slot];
+}
+
+// Releases the iterator's candidate buffer.
+void close_waiting_list_iterator(WaitingListIterator* iterator) {
+    free(iterator->candidates);
+    iterator->candidates = NULL;
+    iterator->remaining = 0;
+}
+
+// Turns on aging so low-acuity patients cannot wait forever: every interval_ms
+// milliseconds of waiting then count as one priority level more urgent, e.g. with
+// 30 minutes per level a level 4 patient who has waited two hours goes ahead of a
+// level 1 patient who just arrived. An interval of 0 turns aging off. Keys encode
+// the aging when a patient arrives (see make_aged_key), so nothing is rescanned
+// later; for the same reason the setting can only change while nobody is waiting.
+// Aged levels are clamped to 0..MAX_AGING_LEVEL. Shards of a ConcurrentTriage
+// refuse aging, since the shards compare the priority level in the top half of
+// each other's keys, and an aged key holds an arrival time there.
+// Returns 0 on success, or -1 if patients are waiting, interval_ms exceeds
+// MAX_AGING_INTERVAL, or the system is a shard and interval_ms is not 0.
+int set_aging_interval(TriageSystem* system, uint32_t interval_ms) {
+    if (waiting_count(system) != 0 || interval_ms > MAX_AGING_INTERVAL || (system->shared_keys && interval_ms != 0)) {
+        return -1;
+    }
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        system->bucket_list->aging_interval = interval_ms;
+    } else {
+        system->waiting_list->aging_interval = interval_ms;
+    }
+    return 0;
+}
+
+// Allocates the wait-time histograms if this system has not treated anyone yet.
+// Returns 0 on success, or -1 if out of memory.
+int reserve_wait_histograms(TriageSystem* system) {
+    if (system->wait_histograms == NULL) {
+        system->wait_histograms = (WaitHistogram*)calloc(WAIT_HISTOGRAM_LEVELS, sizeof(WaitHistogram));
+    }
+    return system->wait_histograms == NULL ? -1 : 0;
+}
+
+// Stamps the patients just treated with the treatment time `now` and adds their
+// waits to the histograms. reserve_wait_histograms must have succeeded first.
+void record_treatments(TriageSystem* system, Patient* patients, int count, uint64_t now) {
+    for (int i = 0; i < count; i++) {
+        patients[i].treatment_time = now;
+        record_wait_time(&system->wait_histograms[wait_histogram_level(patients[i].priority_level)], &patients[i]);
+    }
+}
+
+// Fills in *summary with the door-to-treatment times of the patients treated at a
+// priority level (levels outside 0 .. WAIT_HISTOGRAM_LEVELS - 1 share the nearest
+// histogram). Percentiles come from the histogram, so the query does not look at
+// the treated log. Returns the number of patients counted.
+uint64_t get_wait_time_summary(const TriageSystem* system, int priority_level, WaitTimeSummary* summary) {
+    memset(summary, 0, sizeof(*summary));
+    if (system->wait_histograms == NULL) {
+        return 0;
+    }
+    const WaitHistogram* histogram = &system->wait_histograms[wait_histogram_level(priority_level)];
+    summary->count = histogram->count;
+    if (histogram->count > 0) {
+        summary->mean_ms = (double)histogram->total / (double)histogram->count;
+    }
+    summary->p50_ms = wait_histogram_percentile(histogram, 50.0);
+    summary->p90_ms = wait_histogram_percentile(histogram, 90.0);
+    summary->p99_ms = wait_histogram_percentile(histogram, 99.0);
+    summary->max_ms = histogram->max;
+    return summary->count;
+}
+
+// Makes sure the write-ahead log buffer (if any) can take `count` more records, so
+// an operation is never applied without being logged: commits a full buffer, and
+// enlarges it for batches bigger than the whole buffer.
+// Emits an event and returns -1 on failure, or returns 0.
+int reserve_wal_records(TriageSystem* system, int count, const char* operation) {
+    WriteAheadLog* wal = system->wal;
+    if (wal == NULL || wal->used + count <= wal->capacity) {
+        return 0;
+    }
+    if (commit_write_ahead_log(wal) != 0) {
+        emit_simple_event(system, EVENT_IO_ERROR, -1, count, operation);
+        return -1;
+    }
+    if (count > wal->capacity) {
+        WalRecord* buffer = (WalRecord*)realloc(wal->buffer, (size_t)count * sizeof(WalRecord));
+        if (buffer == NULL) {
+            emit_simple_event(system, EVENT_OUT_OF_MEMORY, -1, count, operation);
+            return -1;
+        }
+        wal->buffer = buffer;
+        wal->capacity = count;
+    }
+    return 0;
+}
+
+// Adds one operation to the write-ahead log buffer, which reserve_wal_records has
+// made room in. Does nothing if the system has no log.
+void log_operation(TriageSystem* system, WalOperation operation, const Patient* patient, int priority_level,
+                   uint32_t sequence, uint64_t time) {
+    WriteAheadLog* wal = system->wal;
+    if (wal == NULL) {
+        return;
+    }
+    WalRecord* record = &wal->buffer[wal->used++];
+    memset(record, 0, sizeof(*record));
+    record->lsn = wal->next_lsn++;
+    record->time = time;
+    record->operation = (uint32_t)operation;
+    record->patient_id = patient->patient_id;
+    record->priority_level = priority_level;
+    record->sequence = sequence;
+    if (operation == WAL_ADMIT) {
+        strcpy(record->name, patient_name(system, patient));
+    }
+    record->checksum = wal_record_checksum(record);
+    system->applied_lsn = record->lsn;
+}
+
+// Starts logging every admission, treatment, re-triage and removal to `wal`, or
+// stops if it is NULL (the log is not closed). Attach after any replay, since
+// replayed operations are not logged again. Operations are durable once
+// commit_write_ahead_log returns; call it once per batch of work (e.g. per request
+// or per tick) to share one disk sync among all of its operations.
+void attach_write_ahead_log(TriageSystem* system, WriteAheadLog* wal) {
+    if (wal != NULL && wal->next_lsn <= system->applied_lsn) {
+        wal->next_lsn = system->applied_lsn + 1; // The log was reset after a checkpoint.
+    }
+    system->wal = wal;
+}
+
+// Starts keeping the most recent `capacity` (rounded up to a power of two, at least
+// 16) waiting-list changes for subscribers; see read_changes. Does nothing if the
+// feed is already on. Returns 0 on success, or -1 if out of memory.
+int enable_change_feed(TriageSystem* system, int capacity) {
+    if (system->changes != NULL) {
+        return 0;
+    }
+    uint64_t records = 16;
+    while (records < (uint64_t)capacity && records < ((uint64_t)1 << 30)) {
+        records <<= 1;
+    }
+    ChangeFeed* feed = (ChangeFeed*)malloc(sizeof(ChangeFeed));
+    if (feed == NULL) {
+        return -1;
+    }
+    feed->records = (ChangeRecord*)malloc((size_t)records * sizeof(ChangeRecord));
+    if (feed->records == NULL) {
+        free(feed);
+        return -1;
+    }
+    feed->mask = records - 1;
+    feed->next_sequence = 0;
+    system->changes = feed;
+    return 0;
+}
+
+// Adds a change to the feed, overwriting the oldest one once the ring is full.
+// Does nothing if the feed is off.
+void publish_change(TriageSystem* system, ChangeType type, const Patient* patient, int priority_level, uint64_t time) {
+    ChangeFeed* feed = system->changes;
+    if (feed == NULL) {
+        return;
+    }
+    ChangeRecord* record = &feed->records[feed->next_sequence & feed->mask];
+    record->sequence = feed->next_sequence++;
+    record->time = time;
+    record->type = type;
+    record->patient_id = patient->patient_id;
+    record->priority_level = priority_level;
+    record->name = patient->name;
+}
+
+// Returns the sequence the next change will get. A new subscriber reads the
+// waiting list once (e.g. with open_waiting_list_iterator) and starts its cursor here.
+uint64_t change_feed_position(const TriageSystem* system) {
+    return system->changes == NULL ? 0 : system->changes->next_sequence;
+}
+
+// Copies up to max changes from sequence *cursor onwards into `out`, oldest first,
+// and moves the cursor past them, so a display refresh costs O(changes) instead of
+// a pass over the whole list. Returns the number copied (0 when up to date), or -1
+// if the feed is off or changes the cursor still needs have already been
+// overwritten; the subscriber must then reread the list and restart its cursor at
+// change_feed_position.
+int read_changes(const TriageSystem* system, uint64_t* cursor, ChangeRecord out[], int max) {
+    const ChangeFeed* feed = system->changes;
+    if (feed == NULL || *cursor > feed->next_sequence || feed->next_sequence - *cursor > feed->mask + 1) {
+        return -1;
+    }
+    int copied = 0;
+    while (copied < max && *cursor < feed->next_sequence) {
+        out[copied++] = feed->records[*cursor & feed->mask];
+        (*cursor)++;
+    }
+    return copied;
+}
+
+// Places a patient with an already chosen ID and arrival sequence on the waiting list.
+// add_patient uses the system's own counters; callers that coordinate several systems
+// supply shared ones. Returns 0 on success, or -1 if there was not enough memory.
+int admit_patient(TriageSystem* system, const char* name, int priority, int patient_id, uint32_t sequence) {
+    ADD_STAT(system->stats.calls[STAT_ADMIT], 1);
+    Patient new_patient = {EMPTY_NAME_HANDLE, priority, patient_id, 0, 0};
+    new_patient.name = intern_name(system, name);
+    if (new_patient.name == INVALID_NAME_HANDLE) {
+        emit_simple_event(system, EVENT_OUT_OF_MEMORY, patient_id, 1, "storing a patient name");
+        return -1;
+    }
+
+    if (reserve_wal_records(system, 1, "logging an admission") != 0) {
+        return -1;
+    }
+    uint64_t arrival_time = triage_now(system);
+    if (waiting_insert(system, new_patient, sequence, arrival_time) != 0) {
+        emit_simple_event(system, EVENT_OUT_OF_MEMORY, patient_id, 1, "adding a patient");
+        return -1;
+    }
+    log_operation(system, WAL_ADMIT, &new_patient, priority, sequence, arrival_time);
+    publish_change(system, CHANGE_ADMITTED, &new_patient, priority, arrival_time);
+    ADD_STAT(system->stats.patients[STAT_ADMIT], 1);
+    TRACE_POINT("admit", patient_id, priority);
+    emit_patient_event(system, EVENT_PATIENT_ADMITTED, &new_patient);
+    return 0;
+}
+
+// Adds a new patient to the waiting list. Names longer than MAX_NAME_LENGTH bytes
+// are cut off. Returns the new patient's ID, or -1 if there was not enough memory.
+int add_patient(TriageSystem* system, const char* name, int priority) {
+    int patient_id = system->next_patient_id;
+    if (admit_patient(system, name, priority, patient_id, system->next_sequence) != 0) {
+        return -1;
+    }
+    system->next_sequence++;
+    system->next_patient_id++;
+    return patient_id;
+}
+
+// Admits a whole batch of patients at once, e.g. an ambulance convoy.
+// Only the name (a handle from intern_name) and priority_level of each entry are
+// used; the patients receive consecutive new IDs.
+// Returns the first ID assigned, or -1 if nobody was added.
+int add_patients_bulk(TriageSystem* system, const Patient* patients, int count) {
+    int first_id = system->next_patient_id;
+    ADD_STAT(system->stats.calls[STAT_BULK_ADMIT], 1);
+    if (count <= 0) {
+        return -1;
+    }
+    if (reserve_wal_records(system, count, "logging a batch of admissions") != 0) {
+        return -1;
+    }
+    uint64_t arrival_time = triage_now(system);
+    if (waiting_append(system, patients, count, first_id, system->next_sequence, arrival_time) != 0) {
+        emit_simple_event(system, EVENT_OUT_OF_MEMORY, -1, count, "adding a batch of patients");
+        return -1;
+    }
+    for (int i = 0; (system->wal != NULL || system->changes != NULL) && i < count; i++) {
+        Patient patient = {patients[i].name, patients[i].priority_level, first_id + i, 0, 0};
+        log_operation(system, WAL_ADMIT, &patient, patient.priority_level, system->next_sequence + (uint32_t)i, arrival_time);
+        publish_change(system, CHANGE_ADMITTED, &patient, patient.priority_level, arrival_time);
+    }
+    system->next_patient_id += count;
+    system->next_sequence += (uint32_t)count;
+    ADD_STAT(system->stats.patients[STAT_BULK_ADMIT], count);
+    TRACE_POINT("bulk_admit", first_id, count);
+    if (system->events.emit != NULL) {
+        TriageEvent event = {EVENT_BATCH_ADMITTED, NULL, NULL, -1, 0, count, first_id, first_id + count - 1, NULL};
+        emit_event(system, &event);
+    }
+    return first_id;
+}
+
+// Returns the array index of the i-th oldest record still held in memory by the
+// treated log.
+int treated_log_index(const TreatedLog* log, int i) {
+    int index = log->head + i;
+    return index >= log->capacity ? index - log->capacity : index;
+}
+
+// Returns a copy of the i-th oldest record still held in memory by the treated log.
+Patient treated_log_record(const TreatedLog* log, int i) {
+    return load_treated_columns(&log->columns, treated_log_index(log, i));
+}
+
+// Returns the treatment time of the i-th oldest record in memory.
+uint64_t treated_log_time(const TreatedLog* log, int i) {
+    return log->columns.treatment_times[treated_log_index(log, i)];
+}
+
+// Makes `entries` (with the given number of buckets) the treated log's patient_id
+// index, releasing the previous one, and refills it from the records in memory.
+void install_treated_id_index(TreatedLog* log, IdIndexEntry* entries, int buckets) {
+    free(log->ids.entries);
+    reset_id_index(&log->ids, entries, buckets);
+    for (int i = 0; i < log->size; i++) {
+        int index = treated_log_index(log, i);
+        id_index_put(&log->ids, log->columns.patient_ids[index], index);
+    }
+}
+
+// Makes room for `count` more entries in a priority level's index, dropping the
+// ones before record number `first` (the oldest record in memory) when it is full.
+// Returns 0 on success, or -1 if out of memory.
+int reserve_level_index(TreatedLevelIndex* index, long long first, int count) {
+    if (count <= index->capacity - index->count) {
+        return 0;
+    }
+    while (index->start < index->count && index->records[index->start] < first) {
+        index->start++;
+    }
+    int live = index->count - index->start;
+    if (index->start > 0) {
+        memmove(index->records, index->records + index->start, (size_t)live * sizeof(long long));
+    }
+    index->start = 0;
+    index->count = live;
+    if (count <= index->capacity - live) {
+        return 0;
+    }
+    int64_t new_capacity = index->capacity == 0 ? 16 : index->capacity;
+    while (new_capacity < (int64_t)live + count) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > INT_MAX) {
+        return -1;
+    }
+    long long* records = (long long*)realloc(index->records, (size_t)new_capacity * sizeof(long long));
+    if (records == NULL) {
+        return -1;
+    }
+    index->records = records;
+    index->capacity = (int)new_capacity;
+    return 0;
+}
+
+// Makes sure the treated log's indexes can take `count` more records: an ID index
+// at most half full for the array's capacity, and room in every level's index.
+// Returns 0 on success, or -1 if out of memory.
+int reserve_treated_indexes(TreatedLog* log, int count) {
+    if (log->ids.entries == NULL || 2 * log->capacity > log->ids.mask + 1) {
+        int buckets = id_index_bucket_count(log->capacity);
+        IdIndexEntry* entries = (IdIndexEntry*)malloc((size_t)buckets * sizeof(IdIndexEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        install_treated_id_index(log, entries, buckets);
+    }
+    long long first = log->total - log->size;
+    for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+        if (reserve_level_index(&log->levels[level], first, count) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Stores a record at array index `index` of the treated log, as record number
+// `number`, keeping the indexes up to date. Any record it overwrites must already
+// have been dropped from the ID index.
+void store_treated_record(TreatedLog* log, int index, long long number, const Patient* patient) {
+    store_treated_columns(&log->columns, index, patient);
+    id_index_put(&log->ids, patient->patient_id, index);
+    TreatedLevelIndex* level = &log->levels[wait_histogram_level(patient->priority_level)];
+    level->records[level->count++] = number;
+}
+
+// Makes sure the treated log's columns can hold `count` more records, growing them
+// according to the log's policy. Returns 0 on success, -1 on failure.
+int reserve_treated_columns(TreatedLog* log, int count) {
+    if (count > INT_MAX - log->size) {
+        return -1;
+    }
+    int required = log->size + count;
+    if (required <= log->capacity) {
+        return 0;
+    }
+    int new_capacity = grown_capacity(&log->growth, log->capacity, required);
+    if (resize_treated_columns(log->arena, &log->columns, log->capacity, new_capacity) != 0) {
+        return -1;
+    }
+    log->capacity = new_capacity;
+    ADD_STAT(log->grows, 1);
+    TRACE_POINT("treated_log_grow", -1, new_capacity);
+    return 0;
+}
+
+// Makes sure `count` treatments can be recorded without failing halfway: room in
+// the in-memory log (unless it is a bounded tail) and its indexes, in the journal
+// buffer, and the wait-time histograms. count must not exceed the journal's buffer capacity.
+// Emits an event and returns -1 on failure, or returns 0.
+int reserve_treated_records(TriageSystem* system, int count, const char* operation) {
+    TreatedLog* log = system->treated_log;
+    if (log->journal != NULL && log->journal->used + count > log->journal->capacity &&
+        flush_treated_journal(log->journal) != 0) {
+        emit_simple_event(system, EVENT_IO_ERROR, -1, count, operation);
+        return -1;
+    }
+    if ((log->tail_limit == 0 && reserve_treated_columns(log, count) != 0) ||
+        reserve_treated_indexes(log, count) != 0 || reserve_wait_histograms(system) != 0) {
+        emit_simple_event(system, EVENT_OUT_OF_MEMORY, -1, count, operation);
+        return -1;
+    }
+    return 0;
+}
+
+// Copies a treated patient into the journal buffer, which must have room.
+void journal_treated_patient(TriageSystem* system, TreatedJournal* journal, const Patient* patient) {
+    TreatedJournalRecord* record = &journal->buffer[journal->used++];
+    memset(record, 0, sizeof(*record)); // No stray padding bytes in the file.
+    record->patient_id = patient->patient_id;
+    record->priority_level = patient->priority_level;
+    record->arrival_time = patient->arrival_time;
+    record->treatment_time = patient->treatment_time;
+    strcpy(record->name, patient_name(system, patient));
+    journal->records++;
+}
+
+// Appends treated patients to the journal (if any) and the in-memory log, after
+// reserve_treated_records has succeeded for them. A bounded tail overwrites its
+// oldest records.
+void append_treated_records(TriageSystem* system, const Patient* patients, int count) {
+    TreatedLog* log = system->treated_log;
+    for (int i = 0; log->journal != NULL && i < count; i++) {
+        journal_treated_patient(system, log->journal, &patients[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        long long number = log->total + i;
+        if (log->size < log->capacity) {
+            store_treated_record(log, treated_log_index(log, log->size++), number, &patients[i]);
+        } else {
+            // Only a bounded tail is ever full here (reserve_treated_records grows the rest).
+            id_index_erase(&log->ids, log->columns.patient_ids[log->head], log->head);
+            store_treated_record(log, log->head, number, &patients[i]);
+            log->head = log->head + 1 == log->capacity ? 0 : log->head + 1;
+        }
+    }
+    log->total += count;
+}
+
+// Streams the treated log to a journal so a 24/7 department runs in constant
+// memory: every treated patient is written to `journal` and only the most recent
+// tail_limit (at least 1) stay in the in-memory log. Records treated before this
+// call are written to the journal first. Passing NULL detaches the journal (without
+// closing it) and lets the in-memory log grow again. The journal must outlive the
+// system or be detached before it is closed. Name pool memory is not bounded by
+// this; it grows with the number of distinct names.
+// Returns 0 on success, or -1 if out of memory or the journal cannot be written
+// (in which case some of the earlier records may already be in the journal, and
+// the system is left as it was).
+int attach_treated_journal(TriageSystem* system, TreatedJournal* journal, int tail_limit) {
+    TreatedLog* log = system->treated_log;
+    int keep = log->size;
+    int capacity = log->capacity;
+    if (journal != NULL) {
+        if (tail_limit < 1) {
+            tail_limit = 1;
+        }
+        keep = log->size < tail_limit ? log->size : tail_limit;
+        capacity = tail_limit;
+    }
+    int buckets = id_index_bucket_count(capacity);
+    TreatedColumns columns = {NULL, NULL, NULL, NULL, NULL};
+    IdIndexEntry* entries = (IdIndexEntry*)malloc((size_t)buckets * sizeof(IdIndexEntry));
+    if (resize_treated_columns(NULL, &columns, 0, capacity) != 0 || entries == NULL) {
+        release_treated_columns(NULL, &columns);
+        free(entries);
+        return -1;
+    }
+    for (int i = 0; journal != NULL && i < log->size; i++) {
+        if (journal->used == journal->capacity && flush_treated_journal(journal) != 0) {
+            release_treated_columns(NULL, &columns);
+            free(entries);
+            return -1;
+        }
+        Patient record = treated_log_record(log, i);
+        journal_treated_patient(system, journal, &record);
+    }
+
+    // Lay the kept records out oldest first in columns of the new capacity.
+    for (int i = 0; i < keep; i++) {
+        Patient record = treated_log_record(log, log->size - keep + i);
+        store_treated_columns(&columns, i, &record);
+    }
+    release_treated_columns(log->arena, &log->columns);
+    log->columns = columns;
+    log->capacity = capacity;
+    log->size = keep;
+    log->head = 0;
+    log->tail_limit = journal != NULL ? tail_limit : 0;
+    log->journal = journal;
+    // Record numbers do not change, so only the ID index needs rebuilding.
+    install_treated_id_index(log, entries, buckets);
+    return 0;
+}
+
+// Copies the treated log's record of a patient into *record in O(1).
+// Returns 0 on success, or -1 if the patient has not been treated or their record
+// has left the in-memory tail.
+int find_treated_patient(const TriageSystem* system, int patient_id, Patient* record) {
+    const TreatedLog* log = system->treated_log;
+    int index = log->ids.entries == NULL ? -1 : id_index_find(&log->ids, patient_id);
+    if (index == -1) {
+        return -1;
+    }
+    *record = load_treated_columns(&log->columns, index);
+    return 0;
+}
+
+// Returns the record number of the first record in memory treated at or after
+// `time`, or log->total if there is none. Records are appended in treatment order,
+// so this is a binary search; it relies on treatment times never going backwards,
+// which holds unless the clock is replaced while patients are being treated.
+long long first_treated_at(const TreatedLog* log, uint64_t time) {
+    int low = 0;
+    int high = log->size;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (treated_log_time(log, middle) < time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return log->total - log->size + low;
+}
+
+// Copies the records in memory of patients treated from `from` (inclusive) to `to`
+// (exclusive), in nanoseconds of triage_now, into `out` in treatment order, up to
+// max of them. Costs O(log n + results). Returns the number copied.
+int find_treated_between(const TriageSystem* system, uint64_t from, uint64_t to, Patient out[], int max) {
+    const TreatedLog* log = system->treated_log;
+    long long first = log->total - log->size;
+    int found = 0;
+    for (long long number = first_treated_at(log, from); number < log->total && found < max; number++) {
+        int i = (int)(number - first);
+        if (treated_log_time(log, i) >= to) {
+            break;
+        }
+        out[found++] = treated_log_record(log, i);
+    }
+    return found;
+}
+
+// Like find_treated_between, but only for patients treated at one priority level,
+// e.g. all priority-1 patients treated in the last hour. Uses the level's index, so
+// it costs O(log n + results) for levels 0 .. WAIT_HISTOGRAM_LEVELS - 1; levels
+// outside that range share an index with the nearest level and are filtered from it.
+int find_treated_by_priority(const TriageSystem* system, int priority_level, uint64_t from, uint64_t to, Patient out[],
+                             int max) {
+    const TreatedLog* log = system->treated_log;
+    const TreatedLevelIndex* index = &log->levels[wait_histogram_level(priority_level)];
+    long long first = log->total - log->size;
+    // Skip entries that have left memory, then those treated before `from`.
+    int low = index->start;
+    int high = index->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        long long number = index->records[middle];
+        if (number < first || treated_log_time(log, (int)(number - first)) < from) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    int found = 0;
+    for (int i = low; i < index->count && found < max; i++) {
+        int record = treated_log_index(log, (int)(index->records[i] - first));
+        if (log->columns.treatment_times[record] >= to) {
+            break;
+        }
+        if (log->columns.priority_levels[record] == priority_level) {
+            out[found++] = load_treated_columns(&log->columns, record);
+        }
+    }
+    return found;
+}
+
+// Fills in *report with the number of patients and mean door-to-treatment time per
+// priority level over the records in memory (the whole log, or the recent tail when
+// a journal is attached). Only the priority and time columns are read, front to
+// back; the order of a wrapped tail does not matter for the totals.
+void report_treated_log(const TriageSystem* system, TreatedLogReport* report) {
+    const TreatedLog* log = system->treated_log;
+    const int* levels = log->columns.priority_levels;
+    const uint64_t* arrivals = log->columns.arrival_times;
+    const uint64_t* treatments = log->columns.treatment_times;
+    uint64_t waits[WAIT_HISTOGRAM_LEVELS] = {0};
+    memset(report, 0, sizeof(*report));
+    for (int i = 0; i < log->size; i++) {
+        int level = wait_histogram_level(levels[i]);
+        report->count[level]++;
+        waits[level] += treatments[i] - arrivals[i];
+    }
+    for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+        if (report->count[level] > 0) {
+            report->mean_wait_ms[level] = (double)waits[level] / (double)report->count[level] / NS_PER_MS;
+        }
+    }
+}
+
+// Treats the next highest-priority patient.
+// Returns the treated patient's ID, or -1 if nobody could be treated.
+int treat_next_patient(TriageSystem* system) {
+    ADD_STAT(system->stats.calls[STAT_TREAT], 1);
+    if (waiting_count(system) == 0) {
+        emit_simple_event(system, EVENT_WAITING_LIST_EMPTY, -1, 0, NULL);
+        return -1;
+    }
+
+    // Make room in the treated log first so a patient is never treated without a record.
+    if (reserve_treated_records(system, 1, "recording a treatment") != 0 ||
+        reserve_wal_records(system, 1, "logging a treatment") != 0) {
+        return -1;
+    }
+    Patient patient = waiting_extract(system);
+    record_treatments(system, &patient, 1, triage_now(system));
+    log_operation(system, WAL_TREAT, &patient, patient.priority_level, 0, patient.treatment_time);
+    publish_change(system, CHANGE_TREATED, &patient, patient.priority_level, patient.treatment_time);
+    append_treated_records(system, &patient, 1);
+    ADD_STAT(system->stats.patients[STAT_TREAT], 1);
+    TRACE_POINT("treat", patient.patient_id, patient.priority_level);
+    emit_patient_event(system, EVENT_PATIENT_TREATED, &patient);
+    return patient.patient_id;
+}
+
+// Re-triages a waiting patient whose condition has changed. How the patient is
+// placed depends on the engine. The heap keeps their original arrival order, so
+// they go ahead of everyone who arrived later at the new level, and an aged key
+// still counts from their arrival. The bucket queue puts them at the back of the
+// new level's queue, as if they had just arrived, and with aging their wait
+// starts over (a new level that shares their old queue keeps their place).
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int update_priority(TriageSystem* system, int patient_id, int new_priority_level) {
+    ADD_STAT(system->stats.calls[STAT_RETRIAGE], 1);
+    if (reserve_wal_records(system, 1, "logging a re-triage") != 0) {
+        return -1;
+    }
+    uint32_t sequence = system->next_sequence;
+    uint64_t now = triage_now(system);
+    if (waiting_change_priority(system, patient_id, new_priority_level, sequence, now) != 0) {
+        emit_simple_event(system, EVENT_PATIENT_NOT_FOUND, patient_id, 0, NULL);
+        return -1;
+    }
+    system->next_sequence++; // Used by the bucket queue, where a re-triage queues afresh.
+    Patient patient = {EMPTY_NAME_HANDLE, new_priority_level, patient_id, 0, 0};
+    log_operation(system, WAL_RETRIAGE, &patient, new_priority_level, sequence, now);
+    publish_change(system, CHANGE_RETRIAGED, &patient, new_priority_level, now);
+    ADD_STAT(system->stats.patients[STAT_RETRIAGE], 1);
+    TRACE_POINT("retriage", patient_id, new_priority_level);
+    if (system->events.emit != NULL) {
+        TriageEvent event = {EVENT_PRIORITY_UPDATED, NULL, NULL, patient_id, new_priority_level, 1, patient_id, patient_id, NULL};
+        emit_event(system, &event);
+    }
+    return 0;
+}
+
+// Removes a patient who left without being seen.
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int remove_patient(TriageSystem* system, int patient_id) {
+    Patient removed;
+    ADD_STAT(system->stats.calls[STAT_REMOVE], 1);
+    if (reserve_wal_records(system, 1, "logging a removal") != 0) {
+        return -1;
+    }
+    if (waiting_remove(system, patient_id, &removed) != 0) {
+        emit_simple_event(system, EVENT_PATIENT_NOT_FOUND, patient_id, 0, NULL);
+        return -1;
+    }
+    uint64_t now = triage_now(system);
+    log_operation(system, WAL_REMOVE, &removed, removed.priority_level, 0, now);
+    publish_change(system, CHANGE_REMOVED, &removed, removed.priority_level, now);
+    ADD_STAT(system->stats.patients[STAT_REMOVE], 1);
+    TRACE_POINT("remove", patient_id, removed.priority_level);
+    emit_patient_event(system, EVENT_PATIENT_REMOVED, &removed);
+    return 0;
+}
+
+// Treats up to k patients at once, e.g. when several treatment bays open together.
+// The patients are copied into `out` (which must have room for k) in the order they
+// should be seen, and appended to the treated log with one block copy. With a
+// journal attached, at most one journal buffer's worth are treated per call.
+// Returns the number of patients treated.
+int treat_next_k(TriageSystem* system, int k, Patient out[]) {
+    const TreatedJournal* journal = system->treated_log->journal;
+    ADD_STAT(system->stats.calls[STAT_BATCH_TREAT], 1);
+    if (k > waiting_count(system)) {
+        k = waiting_count(system);
+    }
+    if (journal != NULL && k > journal->capacity) {
+        k = journal->capacity;
+    }
+    if (k <= 0) {
+        emit_simple_event(system, EVENT_WAITING_LIST_EMPTY, -1, 0, NULL);
+        return 0;
+    }
+    // Reserve the log space first so a batch is never half recorded.
+    if (reserve_treated_records(system, k, "recording a batch of treatments") != 0 ||
+        reserve_wal_records(system, k, "logging a batch of treatments") != 0) {
+        return 0;
+    }
+    int treated = waiting_extract_batch(system, k, out);
+    if (treated <= 0) {
+        emit_simple_event(system, EVENT_OUT_OF_MEMORY, -1, k, "selecting a batch of patients");
+        return 0;
+    }
+    record_treatments(system, out, treated, triage_now(system));
+    for (int i = 0; i < treated; i++) {
+        log_operation(system, WAL_TREAT, &out[i], out[i].priority_level, 0, out[i].treatment_time);
+        publish_change(system, CHANGE_TREATED, &out[i], out[i].priority_level, out[i].treatment_time);
+    }
+    append_treated_records(system, out, treated);
+    ADD_STAT(system->stats.patients[STAT_BATCH_TREAT], treated);
+    TRACE_POINT("batch_treat", out[0].patient_id, treated);
+    if (system->events.emit != NULL) {
+        TriageEvent event = {EVENT_BATCH_TREATED, NULL, NULL, -1, 0, treated, out[0].patient_id, out[treated - 1].patient_id, NULL};
+        emit_event(system, &event);
+    }
+    return treated;
+}
+
+// A copy of a system's counters and sizes, taken by get_triage_stats. The sift
+// depth counts stay zero for the bucket queue engine, which never sifts.
+typedef struct {
+    TriageStats operations;
+    uint64_t sift_up[SIFT_DEPTH_BUCKETS];
+    uint64_t sift_down[SIFT_DEPTH_BUCKETS];
+    uint64_t waiting_list_grows;
+    uint64_t waiting_list_shrinks;
+    uint64_t treated_log_grows;
+    int waiting;
+    int waiting_capacity;
+    long long treated;
+    int treated_capacity;
+} TriageStatsSnapshot;
+
+// Names of the StatOperation values, as used in the Prometheus labels.
+const char* const STAT_OPERATION_NAMES[STAT_OPERATION_COUNT] = {"admit", "bulk_admit", "treat", "batch_treat",
+                                                                "retriage", "remove"};
+
+// Copies the system's counters into a snapshot. All counters read zero in a
+// build with TRIAGE_NO_STATS; the sizes are always filled in.
+void get_triage_stats(const TriageSystem* system, TriageStatsSnapshot* snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->operations = system->stats;
+    if (system->engine == ENGINE_HEAP) {
+        const MinHeap* heap = system->waiting_list;
+        memcpy(snapshot->sift_up, heap->stats.sift_up, sizeof(snapshot->sift_up));
+        memcpy(snapshot->sift_down, heap->stats.sift_down, sizeof(snapshot->sift_down));
+        snapshot->waiting_list_grows = heap->stats.grows;
+        snapshot->waiting_list_shrinks = heap->stats.shrinks;
+        snapshot->waiting_capacity = heap->capacity;
+    } else {
+        snapshot->waiting_list_grows = system->bucket_list->grows;
+        snapshot->waiting_capacity = system->bucket_list->capacity;
+    }
+    snapshot->waiting = waiting_count(system);
+    snapshot->treated_log_grows = system->treated_log->grows;
+    snapshot->treated = system->treated_log->total;
+    snapshot->treated_capacity = system->treated_log->capacity;
+}
+
+// Writes one sift direction of a snapshot as a Prometheus histogram.
+void write_prometheus_sift_depths(FILE* out, const char* direction, const uint64_t depths[]) {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (int depth = 0; depth < SIFT_DEPTH_BUCKETS; depth++) {
+        count += depths[depth];
+        sum += depths[depth] * (uint64_t)depth;
+        fprintf(out, "triage_sift_levels_bucket{direction=\"%s\",le=\"%d\"} %llu\n", direction, depth,
+                (unsigned long long)count);
+    }
+    fprintf(out, "triage_sift_levels_bucket{direction=\"%s\",le=\"+Inf\"} %llu\n", direction, (unsigned long long)count);
+    fprintf(out, "triage_sift_levels_sum{direction=\"%s\"} %llu\n", direction, (unsigned long long)sum);
+    fprintf(out, "triage_sift_levels_count{direction=\"%s\"} %llu\n", direction, (unsigned long long)count);
+}
+
+// Writes a snapshot in the Prometheus text exposition format, e.g. for a scrape
+// endpoint or a node exporter textfile.
+void write_prometheus_stats(FILE* out, const TriageStatsSnapshot* snapshot) {
+    fprintf(out, "# HELP triage_operation_calls_total Calls of each triage operation, failed ones included.\n");
+    fprintf(out, "# TYPE triage_operation_calls_total counter\n");
+    for (int op = 0; op < STAT_OPERATION_COUNT; op++) {
+        fprintf(out, "triage_operation_calls_total{operation=\"%s\"} %llu\n", STAT_OPERATION_NAMES[op],
+                (unsigned long long)snapshot->operations.calls[op]);
+    }
+    fprintf(out, "# HELP triage_operation_patients_total Patients handled by each triage operation.\n");
+    fprintf(out, "# TYPE triage_operation_patients_total counter\n");
+    for (int op = 0; op < STAT_OPERATION_COUNT; op++) {
+        fprintf(out, "triage_operation_patients_total{operation=\"%s\"} %llu\n", STAT_OPERATION_NAMES[op],
+                (unsigned long long)snapshot->operations.patients[op]);
+    }
+    fprintf(out, "# HELP triage_sift_levels Levels a waiting-list heap node moved per sift.\n");
+    fprintf(out, "# TYPE triage_sift_levels histogram\n");
+    write_prometheus_sift_depths(out, "up", snapshot->sift_up);
+    write_prometheus_sift_depths(out, "down", snapshot->sift_down);
+    fprintf(out, "# HELP triage_resizes_total Reallocations of the waiting list and treated log.\n");
+    fprintf(out, "# TYPE triage_resizes_total counter\n");
+    fprintf(out, "triage_resizes_total{structure=\"waiting_list\",direction=\"grow\"} %llu\n",
+            (unsigned long long)snapshot->waiting_list_grows);
+    fprintf(out, "triage_resizes_total{structure=\"waiting_list\",direction=\"shrink\"} %llu\n",
+            (unsigned long long)snapshot->waiting_list_shrinks);
+    fprintf(out, "triage_resizes_total{structure=\"treated_log\",direction=\"grow\"} %llu\n",
+            (unsigned long long)snapshot->treated_log_grows);
+    fprintf(out, "# HELP triage_waiting_patients Patients on the waiting list.\n");
+    fprintf(out, "# TYPE triage_waiting_patients gauge\n");
+    fprintf(out, "triage_waiting_patients %d\n", snapshot->waiting);
+    fprintf(out, "# HELP triage_waiting_capacity Patients the waiting list has room for.\n");
+    fprintf(out, "# TYPE triage_waiting_capacity gauge\n");
+    fprintf(out, "triage_waiting_capacity %d\n", snapshot->waiting_capacity);
+    fprintf(out, "# HELP triage_treated_patients_total Patients treated since the system started.\n");
+    fprintf(out, "# TYPE triage_treated_patients_total counter\n");
+    fprintf(out, "triage_treated_patients_total %lld\n", snapshot->treated);
+    fprintf(out, "# HELP triage_treated_log_capacity Records the in-memory treated log has room for.\n");
+    fprintf(out, "# TYPE triage_treated_log_capacity gauge\n");
+    fprintf(out, "triage_treated_log_capacity %d\n", snapshot->treated_capacity);
+}
+
+// Displays the status of the waiting list.
+void view_waiting_list(TriageSystem* system) {
+    printf("\n--- Current Waiting List ---\n");
+    if (waiting_count(system) == 0) {
+        printf("  (The waiting list is empty)\n");
+    } else {
+        printf("  Total patients waiting: %d\n", waiting_count(system));
+        const Patient* next_patient = waiting_peek(system);
+        printf("  Next to be treated: ID: %d, Name: %s, Priority: %d\n", next_patient->patient_id, patient_name(system, next_patient), next_patient->priority_level);
+    }
+    printf("--------------------------\n");
+}
+
+// Displays the next `count` patients in treatment order (everyone waiting if count
+// is 0), leaving the waiting list untouched.
+void view_waiting_board(TriageSystem* system, int count) {
+    printf("\n--- Waiting Board ---\n");
+    WaitingListIterator iterator;
+    if (open_waiting_list_iterator(system, count, &iterator) != 0) {
+        printf("  (Not enough memory to list the waiting patients)\n");
+    } else if (iterator.remaining == 0) {
+        printf("  (The waiting list is empty)\n");
+    } else {
+        int position = 1;
+        const Patient* patient;
+        while ((patient = next_waiting_patient(&iterator)) != NULL) {
+            printf("  %d. ID: %d, Name: %s, Priority: %d\n", position++, patient->patient_id,
+                   patient_name(system, patient), patient->priority_level);
+        }
+    }
+    close_waiting_list_iterator(&iterator);
+    printf("---------------------\n");
+}
+
+// Displays the log of all treated patients (only the in-memory tail once a journal
+// is attached).
+void view_treated_log(TriageSystem* system) {
+    printf("\n--- Log of Treated Patients ---\n");
+    if (system->treated_log->size == 0) {
+        printf("  (No patients have been treated yet)\n");
+    } else {
+        for (int i = 0; i < system->treated_log->size; i++) {
+            Patient p = treated_log_record(system->treated_log, i);
+            printf("  ID: %d, Name: %s, Priority: %d\n", p.patient_id, patient_name(system, &p), p.priority_level);
+        }
+    }
+    printf("-----------------------------\n");
+}
+
+// Displays door-to-treatment times per priority level.
+void view_wait_times(TriageSystem* system) {
+    printf("\n--- Wait Times by Priority (ms) ---\n");
+    int shown = 0;
+    for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+        WaitTimeSummary summary;
+        if (get_wait_time_summary(system, level, &summary) == 0) {
+            continue;
+        }
+        printf("  Priority %d: %llu treated, mean %.1f, p50 %llu, p90 %llu, p99 %llu, max %llu\n", level,
+               (unsigned long long)summary.count, summary.mean_ms, (unsigned long long)summary.p50_ms,
+               (unsigned long long)summary.p90_ms, (unsigned long long)summary.p99_ms,
+               (unsigned long long)summary.max_ms);
+        shown++;
+    }
+    if (shown == 0) {
+        printf("  (No patients have been treated yet)\n");
+    }
+    printf("-----------------------------------\n");
+}
+
+// Adds to counts[] the number of levels[0 .. n - 1] at each priority level,
+// grouped as for the wait histograms. The bulk of the array is counted 32 (AVX2) or
+// 16 (SSE2, NEON) values at a time: the values are narrowed with saturation to
+// bytes clamped to the histogram range, each level's matches bump per-byte
+// counters, and the byte counters are added up before they can overflow.
+void count_priority_levels(const int* levels, int n, uint64_t counts[WAIT_HISTOGRAM_LEVELS]) {
+    int i = 0;
+#if defined(__AVX2__)
+    // The packs work within 128-bit halves, which reorders the bytes; counting does not care.
+    const __m256i lowest = _mm256_setzero_si256();
+    const __m256i highest = _mm256_set1_epi16(WAIT_HISTOGRAM_LEVELS - 1);
+    while (i + 32 <= n) {
+        __m256i totals[WAIT_HISTOGRAM_LEVELS];
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            totals[level] = _mm256_setzero_si256();
+        }
+        for (int round = 0; round < 255 && i + 32 <= n; round++, i += 32) {
+            const __m256i* values = (const __m256i*)(levels + i);
+            __m256i low = _mm256_packs_epi32(_mm256_loadu_si256(values), _mm256_loadu_si256(values + 1));
+            __m256i high = _mm256_packs_epi32(_mm256_loadu_si256(values + 2), _mm256_loadu_si256(values + 3));
+            low = _mm256_max_epi16(_mm256_min_epi16(low, highest), lowest);
+            high = _mm256_max_epi16(_mm256_min_epi16(high, highest), lowest);
+            __m256i bytes = _mm256_packus_epi16(low, high);
+            for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+                // A matching byte compares as -1, so subtracting the mask counts it.
+                totals[level] = _mm256_sub_epi8(totals[level], _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8((char)level)));
+            }
+        }
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            uint64_t sums[4];
+            _mm256_storeu_si256((__m256i*)sums, _mm256_sad_epu8(totals[level], lowest));
+            counts[level] += sums[0] + sums[1] + sums[2] + sums[3];
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i lowest = _mm_setzero_si128();
+    const __m128i highest = _mm_set1_epi16(WAIT_HISTOGRAM_LEVELS - 1);
+    while (i + 16 <= n) {
+        __m128i totals[WAIT_HISTOGRAM_LEVELS];
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            totals[level] = _mm_setzero_si128();
+        }
+        for (int round = 0; round < 255 && i + 16 <= n; round++, i += 16) {
+            const __m128i* values = (const __m128i*)(levels + i);
+            __m128i low = _mm_packs_epi32(_mm_loadu_si128(values), _mm_loadu_si128(values + 1));
+            __m128i high = _mm_packs_epi32(_mm_loadu_si128(values + 2), _mm_loadu_si128(values + 3));
+            low = _mm_max_epi16(_mm_min_epi16(low, highest), lowest);
+            high = _mm_max_epi16(_mm_min_epi16(high, highest), lowest);
+            __m128i bytes = _mm_packus_epi16(low, high);
+            for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+                totals[level] = _mm_sub_epi8(totals[level], _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)level)));
+            }
+        }
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            uint64_t sums[2];
+            _mm_storeu_si128((__m128i*)sums, _mm_sad_epu8(totals[level], lowest));
+            counts[level] += sums[0] + sums[1];
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const int16x8_t highest = vdupq_n_s16(WAIT_HISTOGRAM_LEVELS - 1);
+    while (i + 16 <= n) {
+        uint8x16_t totals[WAIT_HISTOGRAM_LEVELS];
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            totals[level] = vdupq_n_u8(0);
+        }
+        for (int round = 0; round < 255 && i + 16 <= n; round++, i += 16) {
+            int16x8_t low = vcombine_s16(vqmovn_s32(vld1q_s32(levels + i)), vqmovn_s32(vld1q_s32(levels + i + 4)));
+            int16x8_t high = vcombine_s16(vqmovn_s32(vld1q_s32(levels + i + 8)), vqmovn_s32(vld1q_s32(levels + i + 12)));
+            low = vmaxq_s16(vminq_s16(low, highest), vdupq_n_s16(0));
+            high = vmaxq_s16(vminq_s16(high, highest), vdupq_n_s16(0));
+            uint8x16_t bytes = vcombine_u8(vqmovun_s16(low), vqmovun_s16(high));
+            for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+                totals[level] = vsubq_u8(totals[level], vceqq_u8(bytes, vdupq_n_u8((uint8_t)level)));
+            }
+        }
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            counts[level] += vaddlvq_u8(totals[level]);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        counts[wait_histogram_level(levels[i])]++;
+    }
+}
+
+#if !defined(__AVX2__) && defined(__SSE2__)
+// Returns all ones in each 64-bit lane where a > b as unsigned integers. SSE2 has
+// no 64-bit compare, so the halves are compared as 32-bit values with their sign
+// bits flipped: the high halves decide unless they are equal, then the low ones do.
+__m128i greater_u64_sse2(__m128i a, __m128i b) {
+    const __m128i flip = _mm_set1_epi32(INT32_MIN);
+    a = _mm_xor_si128(a, flip);
+    b = _mm_xor_si128(b, flip);
+    __m128i greater = _mm_cmpgt_epi32(a, b);
+    __m128i equal = _mm_cmpeq_epi32(a, b);
+    __m128i high_greater = _mm_shuffle_epi32(greater, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128i high_equal = _mm_shuffle_epi32(equal, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128i low_greater = _mm_shuffle_epi32(greater, _MM_SHUFFLE(2, 2, 0, 0));
+    return _mm_or_si128(high_greater, _mm_and_si128(high_equal, low_greater));
+}
+#endif
+
+// Writes waits[i] = treatments[i] - arrivals[i] for i in 0 .. n - 1 (n > 0) and
+// sets *min and *max to the shortest and longest. With AVX2, SSE2 or NEON four (or
+// two) waits are handled per instruction; waits are below 2^63 ns, so AVX2's signed
+// 64-bit compares order them correctly, and SSE2 builds its compare from 32-bit ones.
+void compute_waits(const uint64_t* arrivals, const uint64_t* treatments, int n, uint64_t* waits, uint64_t* min,
+                   uint64_t* max) {
+    uint64_t lowest = UINT64_MAX;
+    uint64_t highest = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    if (n >= 4) {
+        __m256i vector_min = _mm256_set1_epi64x(INT64_MAX);
+        __m256i vector_max = _mm256_setzero_si256();
+        for (; i + 4 <= n; i += 4) {
+            __m256i wait = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)(treatments + i)),
+                                            _mm256_loadu_si256((const __m256i*)(arrivals + i)));
+            _mm256_storeu_si256((__m256i*)(waits + i), wait);
+            vector_min = _mm256_blendv_epi8(vector_min, wait, _mm256_cmpgt_epi64(vector_min, wait));
+            vector_max = _mm256_blendv_epi8(vector_max, wait, _mm256_cmpgt_epi64(wait, vector_max));
+        }
+        uint64_t lanes_min[4];
+        uint64_t lanes_max[4];
+        _mm256_storeu_si256((__m256i*)lanes_min, vector_min);
+        _mm256_storeu_si256((__m256i*)lanes_max, vector_max);
+        for (int lane = 0; lane < 4; lane++) {
+            lowest = lanes_min[lane] < lowest ? lanes_min[lane] : lowest;
+            highest = lanes_max[lane] > highest ? lanes_max[lane] : highest;
+        }
+    }
+#elif defined(__SSE2__)
+    if (n >= 2) {
+        __m128i vector_min = _mm_set1_epi64x(-1);
+        __m128i vector_max = _mm_setzero_si128();
+        for (; i + 2 <= n; i += 2) {
+            __m128i wait = _mm_sub_epi64(_mm_loadu_si128((const __m128i*)(treatments + i)),
+                                         _mm_loadu_si128((const __m128i*)(arrivals + i)));
+            _mm_storeu_si128((__m128i*)(waits + i), wait);
+            // No blend in SSE2: pick lanes with and / andnot / or.
+            __m128i shorter = greater_u64_sse2(vector_min, wait);
+            __m128i longer = greater_u64_sse2(wait, vector_max);
+            vector_min = _mm_or_si128(_mm_and_si128(shorter, wait), _mm_andnot_si128(shorter, vector_min));
+            vector_max = _mm_or_si128(_mm_and_si128(longer, wait), _mm_andnot_si128(longer, vector_max));
+        }
+        uint64_t lanes_min[2];
+        uint64_t lanes_max[2];
+        _mm_storeu_si128((__m128i*)lanes_min, vector_min);
+        _mm_storeu_si128((__m128i*)lanes_max, vector_max);
+        for (int lane = 0; lane < 2; lane++) {
+            lowest = lanes_min[lane] < lowest ? lanes_min[lane] : lowest;
+            highest = lanes_max[lane] > highest ? lanes_max[lane] : highest;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (n >= 2) {
+        uint64x2_t vector_min = vdupq_n_u64(UINT64_MAX);
+        uint64x2_t vector_max = vdupq_n_u64(0);
+        for (; i + 2 <= n; i += 2) {
+            uint64x2_t wait = vsubq_u64(vld1q_u64(treatments + i), vld1q_u64(arrivals + i));
+            vst1q_u64(waits + i, wait);
+            vector_min = vbslq_u64(vcltq_u64(wait, vector_min), wait, vector_min);
+            vector_max = vbslq_u64(vcgtq_u64(wait, vector_max), wait, vector_max);
+        }
+        for (int lane = 0; lane < 2; lane++) {
+            lowest = vector_min[lane] < lowest ? vector_min[lane] : lowest;
+            highest = vector_max[lane] > highest ? vector_max[lane] : highest;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        waits[i] = treatments[i] - arrivals[i];
+        lowest = waits[i] < lowest ? waits[i] : lowest;
+        highest = waits[i] > highest ? waits[i] : highest;
+    }
+    *min = lowest;
+    *max = highest;
+}
+
+// Rearranges values[0 .. n - 1] so values[k] is the k-th smallest (quickselect,
+// O(n) expected) and returns it.
+uint64_t select_nth_value(uint64_t* values, int n, int k) {
+    int low = 0;
+    int high = n - 1;
+    while (low < high) {
+        uint64_t pivot = values[low + (high - low) / 2];
+        int i = low;
+        int j = high;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                uint64_t swap = values[i];
+                values[i++] = values[j];
+                values[j--] = swap;
+            }
+        }
+        if (k <= j) {
+            high = j;
+        } else if (k >= i) {
+            low = i;
+        } else {
+            break; // values[k] equals the pivot and is in place.
+        }
+    }
+    return values[k];
+}
+
+// Fills in *range with the shortest, longest and given percentile of the
+// door-to-treatment times over the records in memory (the whole log, or the recent
+// tail once a journal is attached). Unlike get_wait_time_summary the percentile is
+// exact, at the cost of a pass over the time columns and scratch space for the waits.
+// Returns 0 on success, or -1 if out of memory.
+int get_recent_wait_range(const TriageSystem* system, double percentile, WaitRange* range) {
+    const TreatedLog* log = system->treated_log;
+    memset(range, 0, sizeof(*range));
+    if (log->size == 0) {
+        return 0;
+    }
+    uint64_t* waits = (uint64_t*)malloc((size_t)log->size * sizeof(uint64_t));
+    if (waits == NULL) {
+        return -1;
+    }
+    uint64_t min;
+    uint64_t max;
+    compute_waits(log->columns.arrival_times, log->columns.treatment_times, log->size, waits, &min, &max);
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)log->size + 0.5);
+    rank = rank < 1 ? 1 : (rank > (uint64_t)log->size ? (uint64_t)log->size : rank);
+    range->count = (uint64_t)log->size;
+    range->min_ms = min / NS_PER_MS;
+    range->max_ms = max / NS_PER_MS;
+    range->percentile_ms = select_nth_value(waits, log->size, (int)rank - 1) / NS_PER_MS;
+    free(waits);
+    return 0;
+}
+
+// Fills in counts[] with the number of records in memory at each priority level
+// (grouped as for the wait histograms), scanning the priority column with
+// count_priority_levels.
+void count_treated_by_priority(const TriageSystem* system, uint64_t counts[WAIT_HISTOGRAM_LEVELS]) {
+    const TreatedLog* log = system->treated_log;
+    memset(counts, 0, WAIT_HISTOGRAM_LEVELS * sizeof(uint64_t));
+    count_priority_levels(log->columns.priority_levels, log->size, counts);
+}
+
+// Returns how many of heap nodes[0 .. n - 1] have a key below `bound`. AVX2 looks at
+// two 16-byte nodes per compare (flipping the sign bits for an unsigned compare)
+// and counts in the key lanes; SSE2 does the same one node at a time; NEON loads
+// two nodes with their keys split into one register.
+int count_keys_below(const HeapNode* nodes, int n, uint64_t bound) {
+    int64_t count = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    _Static_assert(sizeof(HeapNode) == 16, "two heap nodes per AVX2 register");
+    const __m256i flip = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i limit = _mm256_xor_si256(_mm256_set1_epi64x((long long)bound), flip);
+    const __m256i key_lanes = _mm256_set_epi64x(0, -1, 0, -1);
+    __m256i below = _mm256_setzero_si256();
+    for (; i + 4 <= n; i += 4) {
+        __m256i first = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(nodes + i)), flip);
+        __m256i second = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(nodes + i + 2)), flip);
+        below = _mm256_sub_epi64(below, _mm256_and_si256(_mm256_cmpgt_epi64(limit, first), key_lanes));
+        below = _mm256_sub_epi64(below, _mm256_and_si256(_mm256_cmpgt_epi64(limit, second), key_lanes));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, below);
+    count = lanes[0] + lanes[2];
+#elif defined(__SSE2__)
+    _Static_assert(sizeof(HeapNode) == 16, "one heap node per SSE2 register");
+    const __m128i limit = _mm_set1_epi64x((long long)bound);
+    __m128i below = _mm_setzero_si128();
+    for (; i + 2 <= n; i += 2) {
+        __m128i first = _mm_loadu_si128((const __m128i*)(nodes + i));
+        __m128i second = _mm_loadu_si128((const __m128i*)(nodes + i + 1));
+        below = _mm_sub_epi64(below, greater_u64_sse2(limit, first));
+        below = _mm_sub_epi64(below, greater_u64_sse2(limit, second));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, below);
+    count = lanes[0];
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint64x2_t below = vdupq_n_u64(0);
+    const uint64x2_t limit = vdupq_n_u64(bound);
+    for (; i + 2 <= n; i += 2) {
+        uint64x2x2_t pair = vld2q_u64((const uint64_t*)(nodes + i));
+        below = vsubq_u64(below, vcltq_u64(pair.val[0], limit));
+    }
+    count = (int64_t)(vgetq_lane_u64(below, 0) + vgetq_lane_u64(below, 1));
+#endif
+    for (; i < n; i++) {
+        count += nodes[i].key < bound;
+    }
+    return (int)count;
+}
+
+// Returns how many waiting patients are at least as urgent as priority_level (their
+// level is priority_level or lower), e.g. for a dashboard's "ESI 1-2 waiting" tile.
+// On a heap without aging the levels are read straight from the node keys with
+// count_keys_below, and the bucket queue adds up its per-level counts (walking
+// only the first or last FIFO for levels they share); otherwise the patient records
+// are checked one by one.
+int count_waiting_at_or_above(const TriageSystem* system, int priority_level) {
+    int count = 0;
+    if (system->engine == ENGINE_BUCKET_QUEUE) {
+        const BucketQueue* queue = system->bucket_list;
+        if (priority_level < 0) {
+            // Levels below 0 share the first FIFO with level 0.
+            return bucket_count_at_or_below(queue, 0, priority_level);
+        }
+        if (priority_level == INT_MAX) {
+            return queue->size;
+        }
+        // Every level below the last FIFO's has a FIFO of its own: add up their live
+        // counts, then walk the last FIFO, which holds all the higher levels.
+        int last = priority_level < BUCKET_LEVELS - 1 ? priority_level : BUCKET_LEVELS - 2;
+        for (int level = 0; level <= last; level++) {
+            count += queue->levels[level].waiting;
+        }
+        if (priority_level >= BUCKET_LEVELS - 1) {
+            count += bucket_count_at_or_below(queue, BUCKET_LEVELS - 1, priority_level);
+        }
+        return count;
+    }
+    const MinHeap* heap = system->waiting_list;
+    if (heap->aging_interval != 0) {
+        for (int i = 0; i < heap->size; i++) {
+            count += heap->patients[heap->nodes[i].slot].priority_level <= priority_level;
+        }
+        return count;
+    }
+    if (priority_level == INT_MAX) {
+        return heap->size;
+    }
+    return count_keys_below(heap->nodes, heap->size, make_sort_key(priority_level + 1, 0));
+}
+
+// Displays the patients treated per priority level, with their mean wait, from the
+// records in memory.
+void view_treated_report(TriageSystem* system) {
+    printf("\n--- Treated Patients by Priority ---\n");
+    TreatedLogReport report;
+    report_treated_log(system, &report);
+    int shown = 0;
+    for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+        if (report.count[level] == 0) {
+            continue;
+        }
+        printf("  Priority %d: %llu treated, mean wait %.1f ms\n", level, (unsigned long long)report.count[level],
+               report.mean_wait_ms[level]);
+        shown++;
+    }
+    if (shown == 0) {
+        printf("  (No patients have been treated yet)\n");
+    }
+    printf("------------------------------------\n");
+}
+
+// The header of a waiting-list snapshot file. It is followed by the heap nodes (in
+// heap order, with node i using slot i), the matching patient records, the name
+// pool's hash table and the name text, each laid out exactly as in memory, so
+// restoring is a validation pass plus one block copy per array.
+typedef struct {
+    char magic[4];          // "TRS" followed by a zero byte.
+    uint32_t version;       // TRIAGE_SNAPSHOT_VERSION.
+    uint32_t node_size;     // sizeof(HeapNode) of the writer.
+    uint32_t patient_size;  // sizeof(Patient) of the writer.
+    int32_t arity;
+    int32_t size;           // Patients waiting.
+    int32_t next_patient_id;
+    uint32_t next_sequence;
+    uint32_t aging_interval;
+    int32_t name_bytes;     // Bytes of name text.
+    int32_t name_count;     // Distinct names in the text.
+    int32_t name_buckets;   // Entries in the name hash table.
+    uint64_t elapsed_ns;    // triage_now() when the snapshot was taken.
+    uint64_t applied_lsn;   // Last write-ahead log record the snapshot includes.
+    uint64_t checksum;      // FNV-1a of every byte after the header.
+} TriageSnapshotHeader;
+
+#define TRIAGE_SNAPSHOT_VERSION 2
+
+// Byte offsets of the arrays in a snapshot file.
+typedef struct {
+    size_t nodes;
+    size_t patients;
+    size_t buckets;
+    size_t text;
+    size_t total;
+} SnapshotLayout;
+
+// Computes where each array of a snapshot with the given header lives.
+SnapshotLayout snapshot_layout(const TriageSnapshotHeader* header) {
+    SnapshotLayout layout;
+    layout.nodes = sizeof(TriageSnapshotHeader);
+    layout.patients = layout.nodes + (size_t)header->size * sizeof(HeapNode);
+    layout.buckets = layout.patients + (size_t)header->size * sizeof(Patient);
+    layout.text = layout.buckets + (size_t)header->name_buckets * sizeof(NameHandle);
+    layout.total = layout.text + (size_t)header->name_bytes;
+    return layout;
+}
+
+// Writes the waiting list, ID and sequence counters, and name pool of a heap-engine
+// system to `path`. The file is filled through a shared mapping, synced, and then
+// renamed over `path`, so a crash leaves either the old or the new snapshot.
+// The treated log is not part of the snapshot (see attach_treated_journal).
+// Returns 0 on success, or -1 on failure or for a bucket-queue system.
+int save_triage_snapshot(const TriageSystem* system, const char* path) {
+    if (system->engine != ENGINE_HEAP) {
+        return -1;
+    }
+    const MinHeap* heap = system->waiting_list;
+    const NamePool* names = &system->names;
+    TriageSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TRS", 4);
+    header.version = TRIAGE_SNAPSHOT_VERSION;
+    header.node_size = sizeof(HeapNode);
+    header.patient_size = sizeof(Patient);
+    header.arity = heap->arity;
+    header.size = heap->size;
+    header.next_patient_id = system->next_patient_id;
+    header.next_sequence = system->next_sequence;
+    header.aging_interval = heap->aging_interval;
+    header.name_bytes = names->used;
+    header.name_count = names->count;
+    header.name_buckets = names->bucket_mask + 1;
+    header.elapsed_ns = triage_now(system);
+    header.applied_lsn = system->applied_lsn;
+    SnapshotLayout layout = snapshot_layout(&header);
+
+    size_t path_length = strlen(path);
+    char* temporary_path = (char*)malloc(path_length + 5);
+    if (temporary_path == NULL) {
+        return -1;
+    }
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", 5);
+    int fd = open(temporary_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    char* file = NULL;
+    if (fd >= 0 && ftruncate(fd, (off_t)layout.total) == 0) {
+        file = (char*)mmap(NULL, layout.total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (file == NULL || file == MAP_FAILED) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temporary_path);
+        }
+        free(temporary_path);
+        return -1;
+    }
+
+    HeapNode* nodes = (HeapNode*)(file + layout.nodes);
+    Patient* patients = (Patient*)(file + layout.patients);
+    for (int i = 0; i < heap->size; i++) {
+        nodes[i].key = heap->nodes[i].key;
+        nodes[i].slot = i;
+        patients[i] = heap->patients[heap->nodes[i].slot];
+    }
+    memcpy(file + layout.buckets, names->buckets, (size_t)header.name_buckets * sizeof(NameHandle));
+    memcpy(file + layout.text, names->text, (size_t)names->used);
+    header.checksum = hash_bytes(file + layout.nodes, layout.total - layout.nodes);
+    memcpy(file, &header, sizeof(header));
+
+    int result = msync(file, layout.total, MS_SYNC) == 0 ? 0 : -1;
+    munmap(file, layout.total);
+    if (fsync(fd) != 0) {
+        result = -1;
+    }
+    close(fd);
+    if (result == 0 && rename(temporary_path, path) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        unlink(temporary_path);
+    }
+    free(temporary_path);
+    return result;
+}
+
+// Checks a mapped snapshot: header, file size, checksum, and that the arrays
+// describe a valid heap whose records only use names inside the saved text.
+// Returns 0 if the snapshot can be restored, or -1.
+int validate_snapshot(const char* file, size_t file_size) {
+    TriageSnapshotHeader header;
+    if (file_size < sizeof(header)) {
+        return -1;
+    }
+    memcpy(&header, file, sizeof(header));
+    if (memcmp(header.magic, "TRS", 4) != 0 || header.version != TRIAGE_SNAPSHOT_VERSION ||
+        header.node_size != sizeof(HeapNode) || header.patient_size != sizeof(Patient) ||
+        normalize_arity(header.arity) != header.arity || header.size < 0 || header.name_bytes < 1 ||
+        header.name_buckets < 2 || (header.name_buckets & (header.name_buckets - 1)) != 0 ||
+        header.name_count < 0 || header.name_count >= header.name_buckets) {
+        return -1;
+    }
+    SnapshotLayout layout = snapshot_layout(&header);
+    if (layout.total != file_size || hash_bytes(file + layout.nodes, layout.total - layout.nodes) != header.checksum) {
+        return -1;
+    }
+    const HeapNode* nodes = (const HeapNode*)(file + layout.nodes);
+    const Patient* patients = (const Patient*)(file + layout.patients);
+    const NameHandle* buckets = (const NameHandle*)(file + layout.buckets);
+    const char* text = file + layout.text;
+    int shift = 0;
+    while ((1 << shift) < header.arity) {
+        shift++;
+    }
+    for (int i = 0; i < header.size; i++) {
+        if (nodes[i].slot != i || (i > 0 && nodes[(i - 1) >> shift].key > nodes[i].key) ||
+            patients[i].name >= (NameHandle)header.name_bytes) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < header.name_buckets; i++) {
+        if (buckets[i] >= (NameHandle)header.name_bytes) {
+            return -1;
+        }
+    }
+    return text[0] == '\0' && text[header.name_bytes - 1] == '\0' ? 0 : -1;
+}
+
+// Rebuilds a heap-engine system from a snapshot written by save_triage_snapshot:
+// the file is mapped, validated, and its arrays copied straight into the new
+// system's heap and name pool, with no re-insertion or sifting. The system's clock
+// resumes from the time the snapshot was taken, so waiting times do not include
+// the time the system was down. Returns NULL if the file is missing, damaged or
+// from an incompatible build, or if memory runs out.
+TriageSystem* restore_triage_snapshot(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat status;
+    char* file = NULL;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        file = (char*)mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (file == NULL || file == MAP_FAILED) {
+        return NULL;
+    }
+    size_t file_size = (size_t)status.st_size;
+    TriageSystem* system = NULL;
+    if (validate_snapshot(file, file_size) == 0) {
+        TriageSnapshotHeader header;
+        memcpy(&header, file, sizeof(header));
+        system = create_triage_system_with_arity(header.size > 0 ? header.size : 1, header.arity);
+    }
+    if (system == NULL) {
+        munmap(file, file_size);
+        return NULL;
+    }
+
+    TriageSnapshotHeader header;
+    memcpy(&header, file, sizeof(header));
+    SnapshotLayout layout = snapshot_layout(&header);
+    MinHeap* heap = system->waiting_list;
+    NamePool* names = &system->names;
+    NameHandle* buckets = (NameHandle*)malloc((size_t)header.name_buckets * sizeof(NameHandle));
+    if (buckets == NULL ||
+        reserve_capacity(names->arena, (void**)&names->text, &names->capacity, header.name_bytes, 1, &names->growth) != 0) {
+        free(buckets);
+        free_triage_system(system);
+        munmap(file, file_size);
+        return NULL;
+    }
+    memcpy(buckets, file + layout.buckets, (size_t)header.name_buckets * sizeof(NameHandle));
+    release_block(names->arena, names->buckets);
+    names->buckets = buckets;
+    names->bucket_mask = header.name_buckets - 1;
+    memcpy(names->text, file + layout.text, (size_t)header.name_bytes);
+    names->used = header.name_bytes;
+    names->count = header.name_count;
+
+    // The nodes already form a heap over slots 0 .. size - 1.
+    memcpy(heap->nodes, file + layout.nodes, (size_t)header.size * sizeof(HeapNode));
+    memcpy(heap->patients, file + layout.patients, (size_t)header.size * sizeof(Patient));
+    munmap(file, file_size);
+    heap->size = header.size;
+    heap->free_count = 0;
+    push_free_slots(heap, header.size, heap->capacity);
+    heap->aging_interval = header.aging_interval;
+    for (int i = 0; i < heap->size; i++) {
+        heap->positions[i] = i;
+        if (id_index_find(&heap->ids, heap->patients[i].patient_id) != -1) {
+            free_triage_system(system); // Two records with one ID: not a real snapshot.
+            return NULL;
+        }
+        id_index_put(&heap->ids, heap->patients[i].patient_id, i);
+    }
+    system->next_patient_id = header.next_patient_id;
+    system->next_sequence = header.next_sequence;
+    system->epoch_ns = system->clock.now_ns(system->clock.context) - header.elapsed_ns;
+    system->applied_lsn = header.applied_lsn;
+    return system;
+}
+
+// Moves the sequence counter past a replayed sequence number (allowing for wrap).
+void advance_sequence(TriageSystem* system, uint32_t sequence) {
+    if ((int32_t)(sequence + 1 - system->next_sequence) > 0) {
+        system->next_sequence = sequence + 1;
+    }
+}
+
+// Copies the name of a WAL_ADMIT record, making sure it is terminated.
+void copy_wal_name(const WalRecord* record, char name[MAX_NAME_LENGTH + 1]) {
+    memcpy(name, record->name, MAX_NAME_LENGTH + 1);
+    name[MAX_NAME_LENGTH] = '\0';
+}
+
+// Applies one write-ahead log record to the system, without logging or events.
+// Returns 0 on success, or -1 if the record does not fit the system's state.
+int apply_wal_record(TriageSystem* system, const WalRecord* record) {
+    switch ((WalOperation)record->operation) {
+    case WAL_ADMIT: {
+        Patient patient = {EMPTY_NAME_HANDLE, record->priority_level, record->patient_id, 0, 0};
+        char name[MAX_NAME_LENGTH + 1];
+        copy_wal_name(record, name);
+        patient.name = intern_name(system, name);
+        if (patient.name == INVALID_NAME_HANDLE || waiting_contains(system, patient.patient_id) ||
+            waiting_insert(system, patient, record->sequence, record->time) != 0) {
+            return -1;
+        }
+        if (record->patient_id >= system->next_patient_id) {
+            system->next_patient_id = record->patient_id + 1;
+        }
+        advance_sequence(system, record->sequence);
+        return 0;
+    }
+    case WAL_TREAT: {
+        const Patient* next_patient = waiting_peek(system);
+        if (next_patient == NULL || next_patient->patient_id != record->patient_id ||
+            reserve_treated_records(system, 1, "replaying a treatment") != 0) {
+            return -1;
+        }
+        Patient patient = waiting_extract(system);
+        record_treatments(system, &patient, 1, record->time);
+        append_treated_records(system, &patient, 1);
+        return 0;
+    }
+    case WAL_RETRIAGE:
+        if (waiting_change_priority(system, record->patient_id, record->priority_level, record->sequence, record->time) != 0) {
+            return -1;
+        }
+        advance_sequence(system, record->sequence);
+        return 0;
+    case WAL_REMOVE:
+        return waiting_remove(system, record->patient_id, NULL);
+    }
+    return -1;
+}
+
+// Moves the system's clock forward, if needed, so that triage_now() is at least
+// `time`. Used after replaying records stamped by an earlier run, so that new
+// arrivals and treatments never get earlier times than the replayed ones.
+void advance_triage_clock(TriageSystem* system, uint64_t time) {
+    if (triage_now(system) < time) {
+        system->epoch_ns = system->clock.now_ns(system->clock.context) - time; // Wraps consistently.
+    }
+}
+
+// Recovers the operations that happened after the system's state was saved: every
+// valid record of the write-ahead log at `path` with an LSN above the system's
+// applied_lsn is applied in order, e.g. on top of restore_triage_snapshot or of a
+// new system when no snapshot was taken yet. Replay stops at the first torn or
+// damaged record. The system's clock is then moved past the latest replayed time
+// (see advance_triage_clock). The system must not have a log attached.
+// Returns the number of records applied, or -1 if the file is not a write-ahead log,
+// a record does not fit the state (the log and snapshot do not belong together),
+// or memory runs out.
+long long replay_write_ahead_log(TriageSystem* system, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL || system->wal != NULL) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        return -1;
+    }
+    RecordFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || !record_header_matches(&header, "TRW", WAL_VERSION, sizeof(WalRecord))) {
+        fclose(file);
+        return -1;
+    }
+    long long applied = 0;
+    uint64_t previous_lsn = 0;
+    uint64_t latest_time = 0;
+    WalRecord record;
+    while (read_wal_record(file, previous_lsn, &record)) {
+        previous_lsn = record.lsn;
+        if (record.lsn <= system->applied_lsn) {
+            continue; // Already part of the snapshot.
+        }
+        if (apply_wal_record(system, &record) != 0) {
+            applied = -1;
+            break;
+        }
+        system->applied_lsn = record.lsn;
+        if (record.time > latest_time) {
+            latest_time = record.time;
+        }
+        applied++;
+    }
+    fclose(file);
+    advance_triage_clock(system, latest_time);
+    return applied;
+}
+
+// Reads every valid record of the write-ahead log at `path` into memory, up to the
+// first torn or damaged one, e.g. to simulate a recorded day (see
+// simulate_triage_day). Returns a malloc'd array that the caller frees and sets
+// *count, or returns NULL if the file is not a write-ahead log or memory runs out.
+WalRecord* load_write_ahead_log(const char* path, long long* count) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    RecordFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || !record_header_matches(&header, "TRW", WAL_VERSION, sizeof(WalRecord))) {
+        fclose(file);
+        return NULL;
+    }
+    long long capacity = 1024;
+    WalRecord* records = (WalRecord*)malloc((size_t)capacity * sizeof(WalRecord));
+    *count = 0;
+    uint64_t previous_lsn = 0;
+    while (records != NULL) {
+        if (*count == capacity) {
+            capacity *= 2;
+            WalRecord* grown = (WalRecord*)realloc(records, (size_t)capacity * sizeof(WalRecord));
+            if (grown == NULL) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+        }
+        if (!read_wal_record(file, previous_lsn, &records[*count])) {
+            break;
+        }
+        previous_lsn = records[(*count)++].lsn;
+    }
+    fclose(file);
+    return records;
+}
+
+// Takes a checkpoint: commits the system's write-ahead log, saves a snapshot to
+// snapshot_path (see save_triage_snapshot), and then empties the log, since the
+// snapshot now holds everything in it. If the system stops between the two steps,
+// replay skips the records the snapshot already contains.
+// Returns 0 on success, or -1 on failure (the log is then left as it was).
+int checkpoint_triage_system(TriageSystem* system, const char* snapshot_path) {
+    if (system->wal != NULL && commit_write_ahead_log(system->wal) != 0) {
+        return -1;
+    }
+    if (save_triage_snapshot(system, snapshot_path) != 0) {
+        return -1;
+    }
+    return system->wal != NULL ? reset_write_ahead_log(system->wal) : 0;
+}
+
+// One shard of a ConcurrentTriage queue: an ordinary triage system behind its own lock.
+// top_key mirrors the key of the shard's root (UINT64_MAX when empty) so other threads
+// can compare shards without taking their locks. Each shard sits on its own cache
+// lines so that threads working on different shards do not contend.
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+    TriageSystem* system;
+    _Atomic uint64_t top_key;
+} TriageShard;
+
+// A triage queue that several intake desks and treatment bays can use at once.
+// Arrivals are spread over independently locked shards, so producers rarely wait for
+// each other. Every arrival draws its ID and arrival sequence from shared atomic
+// counters, which makes keys comparable across shards. A bay treats the shard whose
+// root has the best key, and before extracting it re-checks (while holding that
+// shard's lock) that no other shard shows a patient of a strictly more urgent level.
+// Priority levels are therefore never overtaken by a less urgent patient that was
+// already admitted; only first-come, first-served order within a level is relaxed
+// between patients racing into different shards.
+typedef struct {
+    TriageShard* shards;
+    int shard_count;
+    atomic_int next_patient_id;
+    atomic_uint next_sequence;
+    atomic_uint next_shard;
+} ConcurrentTriage;
+
+// Republishes a shard's root key. Must be called with the shard's lock held.
+void publish_shard_top(TriageShard* shard) {
+    atomic_store_explicit(&shard->top_key, waiting_top_key(shard->system), memory_order_release);
+}
+
+// Frees the first `count` shards of an array and the array itself.
+void free_triage_shards(TriageShard* shards, int count) {
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_destroy(&shards[i].lock);
+        free_triage_system(shards[i].system);
+    }
+    free(shards);
+}
+
+// Allocates `count` shards, each an empty triage system with room for `capacity`
+// patients. Returns NULL if out of memory.
+TriageShard* create_triage_shards(int count, int capacity) {
+    size_t bytes = (size_t)count * sizeof(TriageShard); // sizeof is a multiple of the alignment.
+    TriageShard* shards = (TriageShard*)aligned_alloc(_Alignof(TriageShard), bytes);
+    if (shards == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        TriageShard* shard = &shards[i];
+        shard->system = create_triage_system(capacity);
+        if (shard->system == NULL) {
+            free_triage_shards(shards, i);
+            return NULL;
+        }
+        shard->system->shared_keys = 1; // Shards compare keys (see set_aging_interval).
+        pthread_mutex_init(&shard->lock, NULL);
+        atomic_init(&shard->top_key, UINT64_MAX);
+    }
+    return shards;
+}
+
+// Creates a concurrent queue with the given number of shards (at least 1), each
+// starting with room for capacity_per_shard patients. Returns NULL if out of memory.
+ConcurrentTriage* create_concurrent_triage(int shard_count, int capacity_per_shard) {
+    if (shard_count < 1) {
+        shard_count = 1;
+    }
+    ConcurrentTriage* queue = (ConcurrentTriage*)malloc(sizeof(ConcurrentTriage));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->shards = create_triage_shards(shard_count, capacity_per_shard);
+    if (queue->shards == NULL) {
+        free(queue);
+        return NULL;
+    }
+    queue->shard_count = shard_count;
+    atomic_init(&queue->next_patient_id, 1);
+    atomic_init(&queue->next_sequence, 0);
+    atomic_init(&queue->next_shard, 0);
+    return queue;
+}
+
+// Frees a concurrent queue. No other thread may be using it.
+void free_concurrent_triage(ConcurrentTriage* queue) {
+    free_triage_shards(queue->shards, queue->shard_count);
+    free(queue);
+}
+
+// Treats the next patient of a shard whose lock the caller holds, copying the record
+// into *patient and the name into `name` (if not NULL), and republishes the shard's
+// root. Returns 1 if a patient was treated, or 0 if the shard is empty or the
+// treatment could not be recorded.
+int treat_locked_shard(TriageShard* shard, Patient* patient, char* name) {
+    int treated = treat_next_patient(shard->system) != -1;
+    if (treated) {
+        const TreatedLog* log = shard->system->treated_log;
+        *patient = treated_log_record(log, log->size - 1);
+        if (name != NULL) {
+            strcpy(name, patient_name(shard->system, patient));
+        }
+    }
+    publish_shard_top(shard);
+    return treated;
+}
+
+// Adds a patient from any thread. The patient goes to the first shard whose lock is
+// free, starting from a rotating position, so desks only block when every shard is busy.
+// Returns the new patient's ID, or -1 if there was not enough memory.
+int concurrent_add_patient(ConcurrentTriage* queue, const char* name, int priority) {
+    int patient_id = atomic_fetch_add_explicit(&queue->next_patient_id, 1, memory_order_relaxed);
+    uint32_t sequence = atomic_fetch_add_explicit(&queue->next_sequence, 1, memory_order_relaxed);
+    unsigned start = atomic_fetch_add_explicit(&queue->next_shard, 1, memory_order_relaxed) % (unsigned)queue->shard_count;
+
+    TriageShard* shard = NULL;
+    for (int i = 0; i < queue->shard_count && shard == NULL; i++) {
+        TriageShard* candidate = &queue->shards[(start + i) % (unsigned)queue->shard_count];
+        if (pthread_mutex_trylock(&candidate->lock) == 0) {
+            shard = candidate;
+        }
+    }
+    if (shard == NULL) {
+        shard = &queue->shards[start];
+        pthread_mutex_lock(&shard->lock);
+    }
+    int result = admit_patient(shard->system, name, priority, patient_id, sequence);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result == 0 ? patient_id : -1;
+}
+
+// Treats the most urgent waiting patient from any thread. The record is copied into
+// *patient and, if `name` is not NULL, the patient's name into name (which needs
+// MAX_NAME_LENGTH + 1 bytes), since name handles are private to each shard.
+// Returns 1 if a patient was treated, or 0 if the queue was empty or the treatment
+// could not be recorded.
+int concurrent_treat_next(ConcurrentTriage* queue, Patient* patient, char* name) {
+    for (;;) {
+        int best = -1;
+        uint64_t best_key = UINT64_MAX;
+        for (int i = 0; i < queue->shard_count; i++) {
+            uint64_t key = atomic_load_explicit(&queue->shards[i].top_key, memory_order_acquire);
+            if (key < best_key) {
+                best_key = key;
+                best = i;
+            }
+        }
+        if (best == -1) {
+            return 0;
+        }
+
+        TriageShard* shard = &queue->shards[best];
+        pthread_mutex_lock(&shard->lock);
+        uint64_t top_key = waiting_top_key(shard->system);
+        if (top_key == UINT64_MAX) {
+            pthread_mutex_unlock(&shard->lock);
+            continue; // Another bay emptied this shard first.
+        }
+        // Make sure no other shard now shows a strictly more urgent level.
+        uint32_t level = (uint32_t)(top_key >> 32);
+        int outranked = 0;
+        for (int i = 0; i < queue->shard_count && !outranked; i++) {
+            uint64_t key = atomic_load_explicit(&queue->shards[i].top_key, memory_order_acquire);
+            outranked = i != best && (uint32_t)(key >> 32) < level;
+        }
+        if (outranked) {
+            pthread_mutex_unlock(&shard->lock);
+            continue;
+        }
+
+        int treated = treat_locked_shard(shard, patient, name);
+        pthread_mutex_unlock(&shard->lock);
+        return treated;
+    }
+}
+
+// Locks the shard that holds a waiting patient and returns its index, or returns -1
+// if the patient is not waiting in any of the shards. The caller must unlock the shard.
+int lock_shard_of_patient(TriageShard* shards, int shard_count, int patient_id) {
+    for (int i = 0; i < shard_count; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        if (waiting_contains(shards[i].system, patient_id)) {
+            return i;
+        }
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return -1;
+}
+
+// Re-triages a waiting patient from any thread.
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int concurrent_update_priority(ConcurrentTriage* queue, int patient_id, int new_priority_level) {
+    int index = lock_shard_of_patient(queue->shards, queue->shard_count, patient_id);
+    if (index == -1) {
+        return -1;
+    }
+    TriageShard* shard = &queue->shards[index];
+    int result = update_priority(shard->system, patient_id, new_priority_level);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+// Removes a waiting patient from any thread.
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int concurrent_remove_patient(ConcurrentTriage* queue, int patient_id) {
+    int index = lock_shard_of_patient(queue->shards, queue->shard_count, patient_id);
+    if (index == -1) {
+        return -1;
+    }
+    TriageShard* shard = &queue->shards[index];
+    int result = remove_patient(shard->system, patient_id);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+// Returns the number of patients waiting across all shards. The count is exact only
+// when no other thread is changing the queue.
+int concurrent_waiting_count(ConcurrentTriage* queue) {
+    int total = 0;
+    for (int i = 0; i < queue->shard_count; i++) {
+        pthread_mutex_lock(&queue->shards[i].lock);
+        total += waiting_count(queue->shards[i].system);
+        pthread_mutex_unlock(&queue->shards[i].lock);
+    }
+    return total;
+}
+
+// A network of departments (ER, pediatrics, urgent care, ...), each with its own
+// waiting list, lock and treatment pool. Bays normally treat their own department's
+// patients, so departments never contend; a bay steals from another department only
+// when that department's most urgent patient is of a strictly more urgent level than
+// anything waiting at home (or home is empty). Roots are published in the shards'
+// top_key, so choosing a victim takes no locks, and a steal locks just the victim.
+// IDs and arrival sequences come from shared counters, so they are unique across
+// the network. Departments are shards, so they refuse aging (see set_aging_interval):
+// stealing compares the plain levels in their keys.
+typedef struct {
+    TriageShard* departments;
+    int department_count;
+    atomic_int next_patient_id;
+    atomic_uint next_sequence;
+    _Atomic long long* steals; // Patients each department's bays took from elsewhere.
+} TriageFederation;
+
+// Creates a federation of department_count (at least 1) empty departments, each
+// starting with room for capacity_per_department patients. Returns NULL if out of memory.
+TriageFederation* create_triage_federation(int department_count, int capacity_per_department) {
+    if (department_count < 1) {
+        department_count = 1;
+    }
+    TriageFederation* federation = (TriageFederation*)malloc(sizeof(TriageFederation));
+    if (federation == NULL) {
+        return NULL;
+    }
+    federation->steals = (_Atomic long long*)malloc((size_t)department_count * sizeof(_Atomic long long));
+    federation->departments = create_triage_shards(department_count, capacity_per_department);
+    if (federation->steals == NULL || federation->departments == NULL) {
+        if (federation->departments != NULL) {
+            free_triage_shards(federation->departments, department_count);
+        }
+        free(federation->steals);
+        free(federation);
+        return NULL;
+    }
+    for (int i = 0; i < department_count; i++) {
+        atomic_init(&federation->steals[i], 0);
+    }
+    federation->department_count = department_count;
+    atomic_init(&federation->next_patient_id, 1);
+    atomic_init(&federation->next_sequence, 0);
+    return federation;
+}
+
+// Frees a federation. No other thread may be using it.
+void free_triage_federation(TriageFederation* federation) {
+    free_triage_shards(federation->departments, federation->department_count);
+    free(federation->steals);
+    free(federation);
+}
+
+// Returns a department's system, for configuring it (event sink, journal, ...)
+// before other threads start using the federation. set_aging_interval fails on it.
+TriageSystem* federation_department(TriageFederation* federation, int department) {
+    return federation->departments[department].system;
+}
 
-// A simple structure to hold all information for a single patient.
+// Admits a patient to a department from any thread.
+// Returns the new patient's ID, or -1 if there was not enough memory.
+int federation_admit(TriageFederation* federation, int department, const char* name, int priority) {
+    int patient_id = atomic_fetch_add_explicit(&federation->next_patient_id, 1, memory_order_relaxed);
+    uint32_t sequence = atomic_fetch_add_explicit(&federation->next_sequence, 1, memory_order_relaxed);
+    TriageShard* shard = &federation->departments[department];
+    pthread_mutex_lock(&shard->lock);
+    int result = admit_patient(shard->system, name, priority, patient_id, sequence);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result == 0 ? patient_id : -1;
+}
+
+// Returns 1 if a root key outranks another by priority level alone (an empty
+// waiting list, UINT64_MAX, outranks nothing and is outranked by everything).
+int key_outranks(uint64_t key, uint64_t other) {
+    if (key == UINT64_MAX) {
+        return 0;
+    }
+    return other == UINT64_MAX || (uint32_t)(key >> 32) < (uint32_t)(other >> 32);
+}
+
+// Treats the next patient for a bay of the `home` department, from any thread: the
+// home department's most urgent patient, unless another department's root outranks
+// it (see TriageFederation), in which case the most urgent such root is stolen. A
+// victim whose lock is busy is skipped while there is local work. The record is
+// copied into *patient, the name into `name` (if not NULL, MAX_NAME_LENGTH + 1
+// bytes) and the department it came from into *department (if not NULL).
+// Returns 1 if a patient was treated, or 0 if every department was empty or the
+// treatment could not be recorded.
+int federation_treat_next(TriageFederation* federation, int home, Patient* patient, char* name, int* department) {
+    for (;;) {
+        uint64_t home_key = atomic_load_explicit(&federation->departments[home].top_key, memory_order_acquire);
+        int best = home;
+        uint64_t best_key = home_key;
+        for (int i = 0; i < federation->department_count; i++) {
+            uint64_t key = atomic_load_explicit(&federation->departments[i].top_key, memory_order_acquire);
+            if (i != home && key_outranks(key, home_key) && (best == home || key < best_key)) {
+                best = i;
+                best_key = key;
+            }
+        }
+        if (best_key == UINT64_MAX) {
+            return 0; // Nobody is waiting anywhere.
+        }
+
+        TriageShard* shard = &federation->departments[best];
+        int locked = 0;
+        if (best != home && home_key != UINT64_MAX) {
+            locked = pthread_mutex_trylock(&shard->lock) == 0;
+            if (!locked) {
+                best = home; // The victim is busy: do local work rather than wait for it.
+                shard = &federation->departments[home];
+            }
+        }
+        if (!locked) {
+            pthread_mutex_lock(&shard->lock);
+        }
+        uint64_t top_key = waiting_top_key(shard->system);
+        uint64_t current_home = atomic_load_explicit(&federation->departments[home].top_key, memory_order_acquire);
+        if (top_key == UINT64_MAX || (best != home && !key_outranks(top_key, current_home))) {
+            pthread_mutex_unlock(&shard->lock);
+            continue; // The choice went stale while we were getting the lock.
+        }
+        int treated = treat_locked_shard(shard, patient, name);
+        pthread_mutex_unlock(&shard->lock);
+        if (treated && best != home) {
+            atomic_fetch_add_explicit(&federation->steals[home], 1, memory_order_relaxed);
+        }
+        if (treated && department != NULL) {
+            *department = best;
+        }
+        return treated;
+    }
+}
+
+// Re-triages a patient waiting in any department, from any thread.
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int federation_update_priority(TriageFederation* federation, int patient_id, int new_priority_level) {
+    int index = lock_shard_of_patient(federation->departments, federation->department_count, patient_id);
+    if (index == -1) {
+        return -1;
+    }
+    TriageShard* shard = &federation->departments[index];
+    int result = update_priority(shard->system, patient_id, new_priority_level);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+// Removes a patient waiting in any department, from any thread.
+// Returns 0 on success, or -1 if no patient with that ID is waiting.
+int federation_remove_patient(TriageFederation* federation, int patient_id) {
+    int index = lock_shard_of_patient(federation->departments, federation->department_count, patient_id);
+    if (index == -1) {
+        return -1;
+    }
+    TriageShard* shard = &federation->departments[index];
+    int result = remove_patient(shard->system, patient_id);
+    publish_shard_top(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return result;
+}
+
+// Returns the number of patients a department's bays have taken from other
+// departments so far.
+long long federation_steal_count(TriageFederation* federation, int department) {
+    return atomic_load_explicit(&federation->steals[department], memory_order_relaxed);
+}
+
+// One slot of an IntakeRing. `sequence` tells producers and the consumer whose turn it
+// is: it equals the slot's position when free and position + 1 once it holds an arrival.
 typedef struct {
-    char name[60];
-    int priority_level; // A lower number means higher priority (e.g., 1 is the most critical).
-    int patient_id;
-} Patient;
+    _Atomic size_t sequence;
+    int priority_level;
+    char name[MAX_NAME_LENGTH + 1];
+} IntakeCell;
 
-// The Min-Heap structure, which will function as our Priority Queue.
+// A bounded lock-free multi-producer, single-consumer queue of arrivals. Intake
+// threads push registrations without ever taking a lock or touching the heap; the one
+// thread that owns the TriageSystem drains them in batches through add_patients_bulk,
+// so the heap itself stays single-threaded and hot in that thread's cache.
 typedef struct {
-    Patient* patients; // A pointer to an array of Patient structs.
-    int size;          // The current number of patients in the heap.
-    int capacity;      // The total allocated capacity of the patient array.
-} MinHeap;
+    IntakeCell* cells;
+    size_t mask;                                 // Number of cells minus one (a power of two minus one).
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail; // Next position producers will claim.
+    _Alignas(CACHE_LINE_SIZE) size_t head;       // Next position the consumer will read.
+} IntakeRing;
+
+// Number of arrivals moved from the ring into the heap per bulk admission.
+#define INTAKE_DRAIN_CHUNK 256
 
-// The dynamic array structure for logging treated patients.
+// Creates a ring with room for at least `capacity` waiting arrivals (rounded up to a
+// power of two). Returns NULL if out of memory.
+IntakeRing* create_intake_ring(size_t capacity) {
+    size_t cells = 2;
+    while (cells < capacity && cells < ((size_t)1 << 30)) {
+        cells <<= 1;
+    }
+    IntakeRing* ring = (IntakeRing*)aligned_alloc(_Alignof(IntakeRing), sizeof(IntakeRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->cells = (IntakeCell*)malloc(cells * sizeof(IntakeCell));
+    if (ring->cells == NULL) {
+        free(ring);
+        return NULL;
+    }
+    for (size_t i = 0; i < cells; i++) {
+        atomic_init(&ring->cells[i].sequence, i);
+    }
+    ring->mask = cells - 1;
+    atomic_init(&ring->tail, 0);
+    ring->head = 0;
+    return ring;
+}
+
+// Frees a ring. No thread may be using it; undrained arrivals are discarded.
+void free_intake_ring(IntakeRing* ring) {
+    free(ring->cells);
+    free(ring);
+}
+
+// Queues an arrival from any intake thread without blocking. Names longer than
+// MAX_NAME_LENGTH bytes are cut off. The patient gets an ID when the owner thread
+// drains the ring. Returns 0 on success, or -1 if the ring is full right now.
+int intake_ring_push(IntakeRing* ring, const char* name, int priority) {
+    size_t position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    IntakeCell* cell;
+    for (;;) {
+        cell = &ring->cells[position & ring->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            // The cell is free; try to claim this position.
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return -1; // The consumer has not freed this cell yet: the ring is full.
+        } else {
+            position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    cell->priority_level = priority;
+    size_t length = 0;
+    while (name != NULL && length < MAX_NAME_LENGTH && name[length] != '\0') {
+        length++;
+    }
+    if (length > 0) {
+        memcpy(cell->name, name, length);
+    }
+    cell->name[length] = '\0';
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return 0;
+}
+
+// Moves up to max_count queued arrivals into the system's waiting list, in arrival
+// order, using bulk admission. Must only be called by the thread that owns `system`.
+// Cells are released back to producers only after their batch has been admitted, so
+// arrivals are not lost if memory runs out; they are retried on the next drain.
+// Returns the number of patients admitted.
+int drain_intake_ring(IntakeRing* ring, TriageSystem* system, int max_count) {
+    Patient batch[INTAKE_DRAIN_CHUNK];
+    int admitted = 0;
+    while (admitted < max_count) {
+        int count = 0;
+        while (count < INTAKE_DRAIN_CHUNK && admitted + count < max_count) {
+            IntakeCell* cell = &ring->cells[(ring->head + count) & ring->mask];
+            if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != ring->head + count + 1) {
+                break; // Not yet written (or the ring is empty).
+            }
+            batch[count].name = intern_name(system, cell->name);
+            if (batch[count].name == INVALID_NAME_HANDLE) {
+                break;
+            }
+            batch[count].priority_level = cell->priority_level;
+            count++;
+        }
+        if (count == 0 || add_patients_bulk(system, batch, count) == -1) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            IntakeCell* cell = &ring->cells[(ring->head + i) & ring->mask];
+            atomic_store_explicit(&cell->sequence, ring->head + i + ring->mask + 1, memory_order_release);
+        }
+        ring->head += count;
+        admitted += count;
+    }
+    return admitted;
+}
+
+// Requests understood by the triage service.
+typedef enum {
+    SERVICE_ADMIT = 1, // name, priority_level -> patient_id
+    SERVICE_TREAT,     // -> the patient treated
+    SERVICE_RETRIAGE,  // patient_id, priority_level
+    SERVICE_REMOVE,    // patient_id
+    SERVICE_VIEW       // -> waiting count and the next patient
+} ServiceOpcode;
+
+// Outcomes reported in a service response.
+typedef enum {
+    SERVICE_OK = 0,
+    SERVICE_NOT_FOUND, // No such patient is waiting.
+    SERVICE_EMPTY,     // Nobody is waiting.
+    SERVICE_FAILED     // Out of memory or the logs could not be written.
+} ServiceStatus;
+
+// On the wire, a request is a 12-byte header followed by name_length bytes of name:
+//   byte 0 opcode, byte 1 name_length, bytes 2-3 zero,
+//   bytes 4-7 patient_id, bytes 8-11 priority_level (little-endian).
+// A response is a 16-byte header followed by its name:
+//   byte 0 opcode, byte 1 status, byte 2 name_length, byte 3 zero,
+//   bytes 4-7 patient_id, bytes 8-11 priority_level, bytes 12-15 patients waiting.
+// Responses come back in request order, so clients can pipeline any number of
+// requests without waiting for each reply.
+#define SERVICE_REQUEST_HEADER 12
+#define SERVICE_RESPONSE_HEADER 16
+
+// Most clients served at once, and the reply backlog past which a client's input
+// is left unread until it catches up.
+#define SERVICE_MAX_CLIENTS 64
+#define SERVICE_OUTPUT_LIMIT (1 << 20)
+
+// Bytes read from a client per read() call.
+#define SERVICE_READ_CHUNK 65536
+
+// A decoded service request or response.
 typedef struct {
-    Patient* patients;
-    int size;
-    int capacity;
-} TreatedLog;
+    int opcode;
+    int status;         // Responses only.
+    int patient_id;
+    int priority_level;
+    int waiting;        // Responses only.
+    char name[MAX_NAME_LENGTH + 1];
+} ServiceMessage;
+
+// Stores a 32-bit value in little-endian order.
+void put_le32(unsigned char* bytes, uint32_t value) {
+    bytes[0] = (unsigned char)value;
+    bytes[1] = (unsigned char)(value >> 8);
+    bytes[2] = (unsigned char)(value >> 16);
+    bytes[3] = (unsigned char)(value >> 24);
+}
 
-// A main structure to hold pointers to our heap and log.
+// Reads a 32-bit little-endian value.
+uint32_t get_le32(const unsigned char* bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+// Encodes a request into `out`, which needs SERVICE_REQUEST_HEADER + MAX_NAME_LENGTH
+// bytes. Returns the number of bytes written.
+size_t encode_service_request(const ServiceMessage* request, unsigned char* out) {
+    size_t length = strlen(request->name);
+    if (length > MAX_NAME_LENGTH) {
+        length = MAX_NAME_LENGTH;
+    }
+    out[0] = (unsigned char)request->opcode;
+    out[1] = (unsigned char)length;
+    out[2] = 0;
+    out[3] = 0;
+    put_le32(out + 4, (uint32_t)request->patient_id);
+    put_le32(out + 8, (uint32_t)request->priority_level);
+    memcpy(out + SERVICE_REQUEST_HEADER, request->name, length);
+    return SERVICE_REQUEST_HEADER + length;
+}
+
+// Decodes the request at the start of `in`. Returns the bytes it takes up, 0 if
+// `available` bytes do not hold all of it yet, or -1 if it is malformed.
+long decode_service_request(const unsigned char* in, size_t available, ServiceMessage* request) {
+    if (available < SERVICE_REQUEST_HEADER) {
+        return 0;
+    }
+    size_t length = in[1];
+    if (length > MAX_NAME_LENGTH || in[0] < SERVICE_ADMIT || in[0] > SERVICE_VIEW) {
+        return -1;
+    }
+    if (available < SERVICE_REQUEST_HEADER + length) {
+        return 0;
+    }
+    memset(request, 0, sizeof(*request));
+    request->opcode = in[0];
+    request->patient_id = (int32_t)get_le32(in + 4);
+    request->priority_level = (int32_t)get_le32(in + 8);
+    memcpy(request->name, in + SERVICE_REQUEST_HEADER, length);
+    request->name[length] = '\0';
+    return (long)(SERVICE_REQUEST_HEADER + length);
+}
+
+// Encodes a response into `out`, which needs SERVICE_RESPONSE_HEADER +
+// MAX_NAME_LENGTH bytes. Returns the number of bytes written.
+size_t encode_service_response(const ServiceMessage* response, unsigned char* out) {
+    size_t length = strlen(response->name);
+    out[0] = (unsigned char)response->opcode;
+    out[1] = (unsigned char)response->status;
+    out[2] = (unsigned char)length;
+    out[3] = 0;
+    put_le32(out + 4, (uint32_t)response->patient_id);
+    put_le32(out + 8, (uint32_t)response->priority_level);
+    put_le32(out + 12, (uint32_t)response->waiting);
+    memcpy(out + SERVICE_RESPONSE_HEADER, response->name, length);
+    return SERVICE_RESPONSE_HEADER + length;
+}
+
+// Decodes the response at the start of `in`, for clients. Returns the bytes it
+// takes up, 0 if it is not all there yet, or -1 if it is malformed.
+long decode_service_response(const unsigned char* in, size_t available, ServiceMessage* response) {
+    if (available < SERVICE_RESPONSE_HEADER) {
+        return 0;
+    }
+    size_t length = in[2];
+    if (length > MAX_NAME_LENGTH) {
+        return -1;
+    }
+    if (available < SERVICE_RESPONSE_HEADER + length) {
+        return 0;
+    }
+    response->opcode = in[0];
+    response->status = in[1];
+    response->patient_id = (int32_t)get_le32(in + 4);
+    response->priority_level = (int32_t)get_le32(in + 8);
+    response->waiting = (int32_t)get_le32(in + 12);
+    memcpy(response->name, in + SERVICE_RESPONSE_HEADER, length);
+    response->name[length] = '\0';
+    return (long)(SERVICE_RESPONSE_HEADER + length);
+}
+
+// Copies a patient's ID, level and name into a response.
+void describe_patient(TriageSystem* system, const Patient* patient, ServiceMessage* response) {
+    response->patient_id = patient->patient_id;
+    response->priority_level = patient->priority_level;
+    strcpy(response->name, patient_name(system, patient));
+}
+
+// Carries out one request against the system and fills in the response.
+void execute_service_request(TriageSystem* system, const ServiceMessage* request, ServiceMessage* response) {
+    memset(response, 0, sizeof(*response));
+    response->opcode = request->opcode;
+    switch (request->opcode) {
+    case SERVICE_ADMIT:
+        response->patient_id = add_patient(system, request->name, request->priority_level);
+        response->status = response->patient_id == -1 ? SERVICE_FAILED : SERVICE_OK;
+        break;
+    case SERVICE_TREAT:
+        if (waiting_count(system) == 0) {
+            response->status = SERVICE_EMPTY;
+        } else if (treat_next_patient(system) == -1) {
+            response->status = SERVICE_FAILED;
+        } else {
+            const TreatedLog* log = system->treated_log;
+            Patient treated = treated_log_record(log, log->size - 1);
+            describe_patient(system, &treated, response);
+        }
+        break;
+    case SERVICE_RETRIAGE:
+        response->patient_id = request->patient_id;
+        if (!waiting_contains(system, request->patient_id)) {
+            response->status = SERVICE_NOT_FOUND;
+        } else if (update_priority(system, request->patient_id, request->priority_level) != 0) {
+            response->status = SERVICE_FAILED;
+        }
+        break;
+    case SERVICE_REMOVE:
+        response->patient_id = request->patient_id;
+        if (!waiting_contains(system, request->patient_id)) {
+            response->status = SERVICE_NOT_FOUND;
+        } else if (remove_patient(system, request->patient_id) != 0) {
+            response->status = SERVICE_FAILED;
+        }
+        break;
+    case SERVICE_VIEW:
+        if (waiting_count(system) == 0) {
+            response->status = SERVICE_EMPTY;
+        } else {
+            describe_patient(system, waiting_peek(system), response);
+        }
+        break;
+    }
+    response->waiting = waiting_count(system);
+}
+
+// One client of the triage service, with the bytes read but not yet parsed and the
+// replies not yet sent.
 typedef struct {
-    MinHeap* waiting_list;
-    TreatedLog* treated_log;
-    int next_patient_id;
-} TriageSystem;
+    int fd;
+    unsigned char* input;
+    size_t input_used;
+    size_t input_capacity;
+    unsigned char* output;
+    size_t output_used;
+    size_t output_sent;
+    size_t output_capacity;
+} ServiceConnection;
 
-// Creates and returns a pointer to a new Min-Heap.
-MinHeap* create_heap(int capacity) {
-    MinHeap* heap = (MinHeap*)malloc(sizeof(MinHeap));
-    heap->patients = (Patient*)malloc(capacity * sizeof(Patient));
-    heap->size = 0;
-    heap->capacity = capacity;
-    return heap;
+// Makes sure a byte buffer can hold `required` bytes, doubling it as needed.
+// Returns 0 on success, or -1 if out of memory.
+int reserve_bytes(unsigned char** buffer, size_t* capacity, size_t required) {
+    if (required <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity == 0 ? 4096 : *capacity;
+    while (new_capacity < required) {
+        new_capacity *= 2;
+    }
+    unsigned char* grown = (unsigned char*)realloc(*buffer, new_capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buffer = grown;
+    *capacity = new_capacity;
+    return 0;
 }
 
-// A utility function to swap two Patient structs.
-void swap(Patient* a, Patient* b) {
-    Patient temp = *a;
-    *a = *b;
-    *b = temp;
+// Executes every complete request in a connection's input and queues the replies,
+// keeping any partial request for the next read.
+// Returns 0 on success, or -1 if a request is malformed or memory runs out.
+int process_service_input(TriageSystem* system, ServiceConnection* connection) {
+    size_t offset = 0;
+    for (;;) {
+        ServiceMessage request;
+        long used = decode_service_request(connection->input + offset, connection->input_used - offset, &request);
+        if (used < 0) {
+            return -1;
+        }
+        if (used == 0) {
+            break;
+        }
+        if (reserve_bytes(&connection->output, &connection->output_capacity,
+                          connection->output_used + SERVICE_RESPONSE_HEADER + MAX_NAME_LENGTH) != 0) {
+            return -1;
+        }
+        ServiceMessage response;
+        execute_service_request(system, &request, &response);
+        connection->output_used += encode_service_response(&response, connection->output + connection->output_used);
+        offset += (size_t)used;
+    }
+    memmove(connection->input, connection->input + offset, connection->input_used - offset);
+    connection->input_used -= offset;
+    return 0;
 }
 
-// This function restores the heap property by moving a node up the tree.
-// It's used after inserting a new patient.
-void heapify_up(MinHeap* heap, int index) {
-    int parent_index = (index - 1) / 2;
-    // Keep swapping up as long as the child is higher priority (smaller number) than its parent.
-    if (index > 0 && heap->patients[index].priority_level < heap->patients[parent_index].priority_level) {
-        swap(&heap->patients[index], &heap->patients[parent_index]);
-        heapify_up(heap, parent_index);
+// Reads whatever a client has sent and executes the complete requests.
+// Returns 0 to keep the connection, or -1 once it has closed or failed.
+int read_service_connection(TriageSystem* system, ServiceConnection* connection) {
+    if (reserve_bytes(&connection->input, &connection->input_capacity,
+                      connection->input_used + SERVICE_READ_CHUNK) != 0) {
+        return -1;
+    }
+    ssize_t received = read(connection->fd, connection->input + connection->input_used, SERVICE_READ_CHUNK);
+    if (received < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    if (received == 0) {
+        return -1;
     }
+    connection->input_used += (size_t)received;
+    return process_service_input(system, connection);
 }
 
-// This function restores the heap property by moving a node down the tree.
-// It's used after removing the top patient.
-void heapify_down(MinHeap* heap, int index) {
-    int smallest = index;
-    int left_child = 2 * index + 1;
-    int right_child = 2 * index + 2;
+// Sends as much of a client's queued replies as the socket takes without blocking.
+// Returns 0 to keep the connection, or -1 if it failed.
+int write_service_connection(ServiceConnection* connection) {
+    while (connection->output_sent < connection->output_used) {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_sent,
+                            connection->output_used - connection->output_sent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        }
+        connection->output_sent += (size_t)sent;
+    }
+    connection->output_used = 0;
+    connection->output_sent = 0;
+    return 0;
+}
+
+// Closes a client connection and frees its buffers.
+void close_service_connection(ServiceConnection* connection) {
+    close(connection->fd);
+    free(connection->input);
+    free(connection->output);
+    memset(connection, 0, sizeof(*connection));
+    connection->fd = -1;
+}
+
+// Puts a descriptor into non-blocking mode. Returns 0 on success, -1 on failure.
+int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ? -1 : 0;
+}
+
+// Opens a non-blocking listening socket for the triage service. An address made of
+// digits is a TCP port on the loopback interface (the service has no
+// authentication, so it is not exposed to the network); anything else is the path
+// of a Unix domain socket, replacing a stale one. Returns the socket, or -1.
+int open_service_listener(const char* address) {
+    int is_port = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+    int fd = socket(is_port ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int bound;
+    if (is_port) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in inet;
+        memset(&inet, 0, sizeof(inet));
+        inet.sin_family = AF_INET;
+        inet.sin_port = htons((uint16_t)atoi(address));
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(fd, (struct sockaddr*)&inet, sizeof(inet));
+    } else {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(local.sun_path)) {
+            close(fd);
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        unlink(address);
+        bound = bind(fd, (struct sockaddr*)&local, sizeof(local));
+    }
+    if (bound != 0 || listen(fd, SOMAXCONN) != 0 || set_nonblocking(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Serves clients on a listening socket from one thread until *stop becomes
+// non-zero. Each round of the poll() loop reads every ready client, executes all
+// the complete requests it sent (so a pipelined batch costs one read and one
+// write, not one of each per request), commits the write-ahead log once if the
+// system has one, and only then sends the replies, so every acknowledged operation
+// is durable. Returns 0 when stopped, or -1 if polling or the log commit fails.
+int run_triage_service(TriageSystem* system, int listener, const volatile sig_atomic_t* stop) {
+    ServiceConnection clients[SERVICE_MAX_CLIENTS];
+    struct pollfd polled[SERVICE_MAX_CLIENTS + 1];
+    for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+        memset(&clients[i], 0, sizeof(clients[i]));
+        clients[i].fd = -1;
+    }
+    int result = 0;
+    while (!*stop) {
+        polled[0].fd = listener;
+        polled[0].events = POLLIN;
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+            ServiceConnection* client = &clients[i];
+            polled[i + 1].fd = client->fd; // Negative descriptors are ignored by poll.
+            polled[i + 1].events = (short)((client->output_used < SERVICE_OUTPUT_LIMIT ? POLLIN : 0) |
+                                           (client->output_used > client->output_sent ? POLLOUT : 0));
+        }
+        if (poll(polled, SERVICE_MAX_CLIENTS + 1, 1000) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result = -1;
+            break;
+        }
 
-    // Find the smallest among the node and its children.
-    if (left_child < heap->size && heap->patients[left_child].priority_level < heap->patients[smallest].priority_level) {
-        smallest = left_child;
+        if (polled[0].revents & POLLIN) {
+            for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+                if (clients[i].fd != -1) {
+                    continue;
+                }
+                int fd = accept(listener, NULL, NULL);
+                if (fd != -1 && set_nonblocking(fd) != 0) {
+                    close(fd);
+                    fd = -1;
+                }
+                clients[i].fd = fd;
+                break; // One new client per round; the rest wait in the backlog.
+            }
+        }
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+            short events = polled[i + 1].revents;
+            if (clients[i].fd == -1 || events == 0 || polled[i + 1].fd != clients[i].fd) {
+                continue;
+            }
+            if ((events & (POLLERR | POLLNVAL)) ||
+                ((events & (POLLIN | POLLHUP)) && read_service_connection(system, &clients[i]) != 0)) {
+                close_service_connection(&clients[i]);
+            }
+        }
+        if (system->wal != NULL && commit_write_ahead_log(system->wal) != 0) {
+            result = -1;
+            break;
+        }
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+            if (clients[i].fd != -1 && clients[i].output_used > clients[i].output_sent &&
+                write_service_connection(&clients[i]) != 0) {
+                close_service_connection(&clients[i]);
+            }
+        }
     }
-    if (right_child < heap->size && heap->patients[right_child].priority_level < heap->patients[smallest].priority_level) {
-        smallest = right_child;
+    for (int i = 0; i < SERVICE_MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) {
+            close_service_connection(&clients[i]);
+        }
     }
+    return result;
+}
+
+// Set by the signal handler of the `serve` command to stop the service.
+volatile sig_atomic_t service_stop_requested = 0;
 
-    // If the smallest is not the current node, swap them and continue heapifying down.
-    if (smallest != index) {
-        swap(&heap->patients[index], &heap->patients[smallest]);
-        heapify_down(heap, smallest);
+// SIGINT and SIGTERM handler for the `serve` command.
+void request_service_stop(int signal_number) {
+    (void)signal_number;
+    service_stop_requested = 1;
+}
+
+// Runs the triage service on `address` (see open_service_listener) with a fresh
+// system until interrupted. Returns the process exit status.
+int run_service_command(const char* address) {
+    int listener = open_service_listener(address);
+    if (listener == -1) {
+        perror("triage: cannot listen");
+        return 1;
+    }
+    TriageSystem* system = create_triage_system(1024);
+    if (system == NULL) {
+        close(listener);
+        return 1;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_service_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    printf("Triage service listening on %s\n", address);
+    fflush(stdout);
+    int result = run_triage_service(system, listener, &service_stop_requested);
+    close(listener);
+    if (strspn(address, "0123456789") != strlen(address)) {
+        unlink(address);
     }
+    free_triage_system(system);
+    return result == 0 ? 0 : 1;
 }
 
-// Inserts a new patient into the heap.
-void insert_patient_to_heap(MinHeap* heap, Patient patient) {
-    if (heap->size == heap->capacity) {
-        printf("Error: Waiting list is full. Cannot add more patients.\n");
-        return;
+// A small xorshift generator so benchmark runs are repeatable.
+uint32_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return (uint32_t)(x >> 32);
+}
+
+// Measures the average cost of one treat-and-admit cycle on a heap that holds
+// `queue_size` patients: the queue stays at a constant size while every
+// iteration does one extract_min and one insert, as in a steady-state shift.
+double benchmark_heap_cycle(int arity, int queue_size, int iterations) {
+    MinHeap* heap = create_heap(queue_size + 1, arity);
+    uint64_t random_state = 0x9E3779B97F4A7C15ull;
+    Patient patient = {EMPTY_NAME_HANDLE, 0, 0, 0, 0};
+    for (int i = 0; i < queue_size; i++) {
+        patient.priority_level = 1 + (int)(next_random(&random_state) % 5);
+        patient.patient_id = i;
+        insert_patient_to_heap(heap, patient);
     }
-    // Add the new patient to the end and then heapify up to place it correctly.
-    heap->size++;
-    int index = heap->size - 1;
-    heap->patients[index] = patient;
-    heapify_up(heap, index);
+
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < iterations; i++) {
+        extract_min(heap);
+        patient.priority_level = 1 + (int)(next_random(&random_state) % 5);
+        patient.patient_id = queue_size + i;
+        insert_patient_to_heap(heap, patient);
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+
+    free_heap(heap);
+    return (double)elapsed / iterations;
 }
 
-// Extracts the highest-priority patient (the root) from the heap.
-Patient extract_min(MinHeap* heap) {
-    if (heap->size <= 0) {
-        Patient empty_patient = {"", -1, -1}; // Return an invalid patient to indicate error.
-        return empty_patient;
+// Compares the binary waiting list against the 4-ary and 8-ary layouts across queue sizes.
+void run_heap_benchmark(void) {
+    const int queue_sizes[] = {1000, 10000, 100000, 1000000};
+    const int arities[] = {2, 4, 8};
+    const int iterations = 1000000;
+
+    printf("--- Heap Arity Benchmark (ns per extract_min + insert) ---\n");
+    printf("%12s", "queue size");
+    for (size_t a = 0; a < sizeof(arities) / sizeof(arities[0]); a++) {
+        printf("%10d-ary", arities[a]);
     }
-    if (heap->size == 1) {
-        heap->size--;
-        return heap->patients[0];
+    printf("\n");
+    for (size_t q = 0; q < sizeof(queue_sizes) / sizeof(queue_sizes[0]); q++) {
+        printf("%12d", queue_sizes[q]);
+        for (size_t a = 0; a < sizeof(arities) / sizeof(arities[0]); a++) {
+            printf("%14.1f", benchmark_heap_cycle(arities[a], queue_sizes[q], iterations));
+        }
+        printf("\n");
     }
+}
 
-    // Save the root, move the last element to the root, and heapify down.
-    Patient root = heap->patients[0];
-    heap->patients[0] = heap->patients[heap->size - 1];
-    heap->size--;
-    heapify_down(heap, 0);
+// Operations measured by the load benchmark.
+enum {
+    LOAD_INSERT,
+    LOAD_EXTRACT,
+    LOAD_RETRIAGE,
+    LOAD_BULK_INSERT,
+    LOAD_BULK_EXTRACT,
+    LOAD_OPERATION_COUNT
+};
+
+const char* const LOAD_OPERATION_NAMES[LOAD_OPERATION_COUNT] = {"insert", "extract_min", "re-triage", "bulk insert",
+                                                               "bulk extract"};
 
-    return root;
+// What the load benchmark measured for one operation: the latency of each call in
+// nanoseconds, and the patients handled, for throughput.
+typedef struct {
+    WaitHistogram latency;
+    uint64_t patients;
+} LoadStats;
+
+// TriageClock callback for a clock that only moves when the caller advances the
+// uint64_t it points at, so simulated arrival streams get realistic timestamps.
+uint64_t manual_clock_now(void* context) {
+    return *(const uint64_t*)context;
 }
 
-// Initializes the entire triage system.
-TriageSystem* create_triage_system(int initial_capacity) {
-    TriageSystem* system = (TriageSystem*)malloc(sizeof(TriageSystem));
-    system->waiting_list = create_heap(initial_capacity);
-    system->treated_log = (TreatedLog*)malloc(sizeof(TreatedLog));
-    system->treated_log->patients = (Patient*)malloc(initial_capacity * sizeof(Patient));
-    system->treated_log->size = 0;
-    system->treated_log->capacity = initial_capacity;
-    system->next_patient_id = 1;
-    return system;
+// Returns a uniform random number in (0, 1].
+double next_unit_random(uint64_t* state) {
+    return ((double)next_random(state) + 1.0) / 4294967296.0;
 }
 
-// Frees all dynamically allocated memory to prevent memory leaks.
-void free_triage_system(TriageSystem* system) {
-    free(system->waiting_list->patients);
-    free(system->waiting_list);
-    free(system->treated_log->patients);
-    free(system->treated_log);
-    free(system);
+// Natural logarithm of x in (0, 1], so the benchmark does not need libm. x is split
+// into m * 2^e with m in [1, 2), and ln(m) comes from the series
+// 2 * atanh((m - 1) / (m + 1)), which is accurate to about 1e-7 here.
+double natural_log(double x) {
+    int exponent = 0;
+    while (x < 1.0) {
+        x *= 2.0;
+        exponent--;
+    }
+    double z = (x - 1.0) / (x + 1.0);
+    double z2 = z * z;
+    double series = z * (1.0 + z2 * (1.0 / 3 + z2 * (1.0 / 5 + z2 * (1.0 / 7 + z2 * (1.0 / 9 + z2 / 11)))));
+    return 2.0 * series + exponent * 0.69314718055994530942;
 }
 
-// Adds a new patient to the waiting list.
-void add_patient(TriageSystem* system, const char* name, int priority) {
-    Patient new_patient;
-    strcpy(new_patient.name, name);
-    new_patient.priority_level = priority;
-    new_patient.patient_id = system->next_patient_id++;
+// Returns an exponentially distributed gap with the given mean, the time between
+// arrivals of a Poisson stream.
+uint64_t next_exponential(uint64_t* state, double mean) {
+    return (uint64_t)(-natural_log(next_unit_random(state)) * mean);
+}
 
-    insert_patient_to_heap(system->waiting_list, new_patient);
-    printf("NEW PATIENT: '%s' added to waiting list with priority %d.\n", name, priority);
+// Returns a priority from 1 to 5 in roughly the mix seen at emergency departments:
+// few level 1 patients, most at levels 3 and 4.
+int next_triage_level(uint64_t* state) {
+    static const int cumulative[] = {10, 160, 610, 910, 1000}; // Per mille, levels 1-5.
+    int draw = (int)(next_random(state) % 1000);
+    int level = 0;
+    while (draw >= cumulative[level]) {
+        level++;
+    }
+    return level + 1;
 }
 
-// Treats the next highest-priority patient.
-void treat_next_patient(TriageSystem* system) {
-    if (system->waiting_list->size == 0) {
-        printf("SYSTEM: No patients in the waiting list to treat.\n");
-        return;
+// Runs a call, timing it into a LoadStats and counting the patients it handled.
+#define TIME_LOAD_OPERATION(stats, handled, call)                        \
+    do {                                                                 \
+        uint64_t started = monotonic_ns();                               \
+        call;                                                            \
+        add_histogram_value(&(stats).latency, monotonic_ns() - started); \
+        (stats).patients += (uint64_t)(handled);                         \
+    } while (0)
+
+// Drives one system through a realistic arrival stream of `patients` patients:
+// Poisson arrivals (a mean of 30 simulated seconds apart) with a skewed priority
+// mix and occasional ambulance surges admitted in bulk, then a steady shift of
+// `patients` mixed admissions, treatments and re-triages, then a drain in batches.
+// Every call is timed into stats[LOAD_*]. If `counters` is not NULL, it receives
+// the system's own statistics at the end.
+void benchmark_engine_load(WaitingListEngine engine, int arity, int patients, LoadStats stats[],
+                           TriageStatsSnapshot* counters) {
+    memset(stats, 0, LOAD_OPERATION_COUNT * sizeof(LoadStats));
+    uint64_t simulated_ns = 0;
+    TriageSystem* system = create_triage_system_with_engine(1024, engine, arity);
+    TriageClock clock = {manual_clock_now, &simulated_ns};
+    set_triage_clock(system, clock);
+    uint64_t random_state = 0x2545F4914F6CDD1Dull ^ (uint64_t)patients;
+    char names[64][MAX_NAME_LENGTH + 1];
+    for (int i = 0; i < 64; i++) {
+        snprintf(names[i], sizeof(names[i]), "Patient %d", i);
+    }
+    const double mean_gap = 30e9;
+
+    Patient surge[64];
+    int admitted = 0;
+    while (admitted < patients) {
+        simulated_ns += next_exponential(&random_state, mean_gap);
+        if (next_random(&random_state) % 500 == 0) {
+            int count = 10 + (int)(next_random(&random_state) % 31);
+            if (count > patients - admitted) {
+                count = patients - admitted;
+            }
+            for (int i = 0; i < count; i++) {
+                surge[i].name = intern_name(system, names[i]);
+                surge[i].priority_level = next_triage_level(&random_state);
+            }
+            TIME_LOAD_OPERATION(stats[LOAD_BULK_INSERT], count, add_patients_bulk(system, surge, count));
+            admitted += count;
+        } else {
+            const char* name = names[next_random(&random_state) % 64];
+            int level = next_triage_level(&random_state);
+            TIME_LOAD_OPERATION(stats[LOAD_INSERT], 1, add_patient(system, name, level));
+            admitted++;
+        }
+    }
+
+    for (int i = 0; i < patients; i++) {
+        simulated_ns += next_exponential(&random_state, mean_gap / 2);
+        uint32_t draw = next_random(&random_state) % 100;
+        if (draw < 45) {
+            const char* name = names[next_random(&random_state) % 64];
+            int level = next_triage_level(&random_state);
+            TIME_LOAD_OPERATION(stats[LOAD_INSERT], 1, add_patient(system, name, level));
+        } else if (draw < 90) {
+            TIME_LOAD_OPERATION(stats[LOAD_EXTRACT], 1, treat_next_patient(system));
+        } else {
+            // A random ID that has been admitted; some have already been treated.
+            int patient_id = 1 + (int)(next_random(&random_state) % (uint32_t)(system->next_patient_id - 1));
+            int level = next_triage_level(&random_state);
+            TIME_LOAD_OPERATION(stats[LOAD_RETRIAGE], 1, update_priority(system, patient_id, level));
+        }
     }
 
-    Patient patient_to_treat = extract_min(system->waiting_list);
+    Patient batch[32];
+    while (waiting_count(system) > 0) {
+        simulated_ns += next_exponential(&random_state, mean_gap);
+        int treated = 0;
+        TIME_LOAD_OPERATION(stats[LOAD_BULK_EXTRACT], treated, treated = treat_next_k(system, 32, batch));
+    }
+    if (counters != NULL) {
+        get_triage_stats(system, counters);
+    }
+    free_triage_system(system);
+}
 
-    printf("\nTREATING NEXT PATIENT:\n");
-    printf("  ID: %d, Name: %s, Priority: %d\n", patient_to_treat.patient_id, patient_to_treat.name, patient_to_treat.priority_level);
+// Runs the load benchmark for every waiting list engine at 10^3 .. max_patients
+// patients and prints throughput and per-call latency for each operation.
+void run_load_benchmark(int max_patients) {
+    const struct {
+        const char* name;
+        WaitingListEngine engine;
+        int arity;
+    } engines[] = {{"heap-2", ENGINE_HEAP, 2}, {"heap-4", ENGINE_HEAP, 4}, {"heap-8", ENGINE_HEAP, 8},
+                   {"bucket", ENGINE_BUCKET_QUEUE, 0}};
 
-    // Add the treated patient to our dynamic array log.
-    if (system->treated_log->size < system->treated_log->capacity) {
-        system->treated_log->patients[system->treated_log->size++] = patient_to_treat;
-    } else {
-        // Here, a real system would reallocate more memory for the log.
-        printf("Warning: Treated log is full.\n");
+    printf("--- Triage Load Benchmark (Poisson arrivals, skewed priorities, surges) ---\n");
+    printf("Latencies are per call and include about 20 ns of timer overhead.\n");
+#ifdef TRIAGE_NO_STATS
+    printf("Hot-path counters are compiled out (TRIAGE_NO_STATS).\n");
+#else
+    printf("Hot-path counters are compiled in; build with -DTRIAGE_NO_STATS to measure their overhead.\n");
+#endif
+    printf("%-8s %10s %-13s %12s %14s %8s %8s %8s\n", "engine", "patients", "operation", "calls", "patients/s",
+           "p50 ns", "p99 ns", "max ns");
+    for (int patients = 1000; patients <= max_patients; patients *= 10) {
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            LoadStats stats[LOAD_OPERATION_COUNT];
+            benchmark_engine_load(engines[e].engine, engines[e].arity, patients, stats, NULL);
+            for (int op = 0; op < LOAD_OPERATION_COUNT; op++) {
+                const WaitHistogram* latency = &stats[op].latency;
+                if (latency->count == 0) {
+                    continue;
+                }
+                double rate = latency->total > 0 ? (double)stats[op].patients * 1e9 / (double)latency->total : 0.0;
+                printf("%-8s %10d %-13s %12llu %14.0f %8llu %8llu %8llu\n", engines[e].name, patients,
+                       LOAD_OPERATION_NAMES[op], (unsigned long long)latency->count, rate,
+                       (unsigned long long)wait_histogram_percentile(latency, 50.0),
+                       (unsigned long long)wait_histogram_percentile(latency, 99.0),
+                       (unsigned long long)latency->max);
+            }
+        }
     }
 }
 
-// Displays the status of the waiting list.
-void view_waiting_list(TriageSystem* system) {
-    printf("\n--- Current Waiting List ---\n");
-    if (system->waiting_list->size == 0) {
-        printf("  (The waiting list is empty)\n");
+// Runs the load benchmark's workload once on a 4-ary heap and prints the system's
+// statistics in the Prometheus text format.
+void run_stats_command(int patients) {
+    LoadStats stats[LOAD_OPERATION_COUNT];
+    TriageStatsSnapshot counters;
+    benchmark_engine_load(ENGINE_HEAP, 4, patients, stats, &counters);
+    write_prometheus_stats(stdout, &counters);
+}
+
+// A what-if setting for simulate_triage_day: the waiting-list policy, and either
+// the recorded staffing or a number of treatment bays.
+typedef struct {
+    WaitingListEngine engine;
+    int arity;               // Heap arity for ENGINE_HEAP (see create_triage_system_with_engine).
+    uint32_t aging_interval; // See set_aging_interval; 0 for no aging.
+    int bays;                // Treatment bays, or 0 to treat whenever the recording did.
+    uint64_t treatment_ns[WAIT_HISTOGRAM_LEVELS]; // Time a bay is busy per patient, by level (with bays).
+} SimulationScenario;
+
+// What one simulated day produced.
+typedef struct {
+    long long events;   // Recorded operations replayed plus simulated treatments.
+    long long admitted;
+    long long treated;
+    long long removed;  // Patients who left without being seen.
+    long long skipped;  // Recorded re-triages, removals and treatments that no longer applied.
+    int peak_waiting;
+    int still_waiting;  // Patients waiting after the last event.
+    uint64_t end_time;  // Virtual time of the last event.
+    WaitTimeSummary waits[WAIT_HISTOGRAM_LEVELS];
+} SimulationResult;
+
+// Replays one recorded operation into a simulated day. Admissions keep their
+// recorded IDs so later re-triages and removals find them; recorded treatments
+// are followed only when the scenario uses the recorded staffing, and then treat
+// whoever this scenario's policy puts first. Returns 0, or -1 if memory runs out.
+int replay_simulation_record(TriageSystem* system, const WalRecord* record, const SimulationScenario* scenario,
+                             SimulationResult* result) {
+    switch ((WalOperation)record->operation) {
+    case WAL_ADMIT: {
+        char name[MAX_NAME_LENGTH + 1];
+        copy_wal_name(record, name);
+        if (admit_patient(system, name, record->priority_level, record->patient_id, system->next_sequence) != 0) {
+            return -1;
+        }
+        system->next_sequence++;
+        if (record->patient_id >= system->next_patient_id) {
+            system->next_patient_id = record->patient_id + 1;
+        }
+        result->admitted++;
+        break;
+    }
+    case WAL_TREAT:
+        if (scenario->bays > 0) {
+            return 0; // Treatments come from the bays instead.
+        }
+        if (waiting_count(system) == 0) {
+            result->skipped++;
+        } else if (treat_next_patient(system) == -1) {
+            return -1;
+        } else {
+            result->treated++;
+        }
+        break;
+    case WAL_RETRIAGE:
+        if (update_priority(system, record->patient_id, record->priority_level) != 0) {
+            result->skipped++;
+        }
+        break;
+    case WAL_REMOVE:
+        if (remove_patient(system, record->patient_id) == 0) {
+            result->removed++;
+        } else {
+            result->skipped++;
+        }
+        break;
+    }
+    result->events++;
+    return 0;
+}
+
+// Parameters of the bay heap of simulate_triage_day: the times the bays become free.
+#define BAY_FREE_TIME(context, time) (time)
+#define BAY_MOVED(context, time, index) ((void)0)
+
+DEFINE_PRIORITY_QUEUE(bay_times, uint64_t, void*, BAY_FREE_TIME, HEAP_KEY_LESS, 4, BAY_MOVED)
+
+// Runs a recorded day (records from load_write_ahead_log, in LSN order) through a
+// fresh system under `scenario`, on a virtual clock that jumps from event to event,
+// so a day takes well under a second and two runs always give the same result.
+// Nothing is printed. With bays, a bay that becomes free treats the next patient
+// and stays busy for the scenario's treatment time, and the day runs until every
+// patient is treated. The systems share nothing, so independent scenarios can run
+// on different threads (see run_simulations). Returns 0, or -1 if memory runs out.
+int simulate_triage_day(const WalRecord* records, long long count, const SimulationScenario* scenario,
+                        SimulationResult* result) {
+    memset(result, 0, sizeof(*result));
+    int bays = scenario->bays > 0 ? scenario->bays : 0;
+    uint64_t* bay_free = (uint64_t*)calloc(bays > 0 ? (size_t)bays : 1, sizeof(uint64_t)); // All free at 0.
+    TriageSystem* system = create_triage_system_with_engine(1024, scenario->engine, scenario->arity);
+    uint64_t now = 0;
+    int status = bay_free != NULL && system != NULL ? 0 : -1;
+    if (status == 0) {
+        TriageClock clock = {manual_clock_now, &now};
+        set_triage_clock(system, clock);
+        status = set_aging_interval(system, scenario->aging_interval);
+    }
+    long long next = 0;
+    while (status == 0 && (next < count || (bays > 0 && waiting_count(system) > 0))) {
+        uint64_t record_time = next < count ? records[next].time : UINT64_MAX;
+        uint64_t start = bay_free[0] > now ? bay_free[0] : now;
+        if (bays > 0 && waiting_count(system) > 0 && start < record_time) {
+            now = start;
+            int patient_id = treat_next_patient(system);
+            if (patient_id == -1) {
+                status = -1;
+                break;
+            }
+            const TreatedLog* log = system->treated_log;
+            int level = wait_histogram_level(log->columns.priority_levels[treated_log_index(log, log->size - 1)]);
+            bay_free[0] = now + scenario->treatment_ns[level];
+            bay_times_sift_down(bay_free, bays, 0, NULL);
+            result->treated++;
+            result->events++;
+            continue;
+        }
+        if (record_time > now) {
+            now = record_time;
+        }
+        status = replay_simulation_record(system, &records[next++], scenario, result);
+        if (waiting_count(system) > result->peak_waiting) {
+            result->peak_waiting = waiting_count(system);
+        }
+    }
+    if (status == 0) {
+        result->still_waiting = waiting_count(system);
+        result->end_time = now;
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            get_wait_time_summary(system, level, &result->waits[level]);
+        }
+    }
+    if (system != NULL) {
+        free_triage_system(system);
+    }
+    free(bay_free);
+    return status;
+}
+
+// Scenarios shared by the threads of run_simulations, which take them in turn.
+typedef struct {
+    const WalRecord* records;
+    long long count;
+    const SimulationScenario* scenarios;
+    SimulationResult* results;
+    int scenario_count;
+    atomic_int next_scenario;
+    atomic_int failures;
+} SimulationBatch;
+
+// Thread body of run_simulations.
+void* run_simulation_worker(void* argument) {
+    SimulationBatch* batch = (SimulationBatch*)argument;
+    for (;;) {
+        int index = atomic_fetch_add(&batch->next_scenario, 1);
+        if (index >= batch->scenario_count) {
+            return NULL;
+        }
+        if (simulate_triage_day(batch->records, batch->count, &batch->scenarios[index], &batch->results[index]) != 0) {
+            atomic_fetch_add(&batch->failures, 1);
+        }
+    }
+}
+
+// Runs every scenario over the same recorded day, spread over up to `threads`
+// threads (1 runs them all on the calling thread); results[i] belongs to
+// scenarios[i]. Returns 0, or -1 if any scenario failed or a thread could not be started.
+int run_simulations(const WalRecord* records, long long count, const SimulationScenario scenarios[],
+                    SimulationResult results[], int scenario_count, int threads) {
+    SimulationBatch batch = {records, count, scenarios, results, scenario_count, 0, 0};
+    if (threads > scenario_count) {
+        threads = scenario_count;
+    }
+    pthread_t* workers = (pthread_t*)malloc((threads > 1 ? (size_t)threads - 1 : 1) * sizeof(pthread_t));
+    if (workers == NULL) {
+        return -1;
+    }
+    int started = 0;
+    while (started < threads - 1 && pthread_create(&workers[started], NULL, run_simulation_worker, &batch) == 0) {
+        started++;
+    }
+    run_simulation_worker(&batch);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    return atomic_load(&batch.failures) == 0 && started == (threads > 1 ? threads - 1 : 0) ? 0 : -1;
+}
+
+// Replays the day recorded in the write-ahead log at `path`: once with the recorded
+// treatments, and once for each bay count with `treatment_minutes` per patient,
+// all in parallel, then prints the 90th percentile wait of each level.
+// Returns the process exit status.
+int run_simulate_command(const char* path, double treatment_minutes, char* bay_counts[], int bay_count_count) {
+    long long count = 0;
+    WalRecord* records = load_write_ahead_log(path, &count);
+    if (records == NULL) {
+        fprintf(stderr, "triage: cannot read write-ahead log %s\n", path);
+        return 1;
+    }
+    int scenario_count = bay_count_count + 1;
+    SimulationScenario* scenarios = (SimulationScenario*)calloc((size_t)scenario_count, sizeof(SimulationScenario));
+    SimulationResult* results = (SimulationResult*)calloc((size_t)scenario_count, sizeof(SimulationResult));
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int status = scenarios != NULL && results != NULL ? 0 : -1;
+    for (int i = 0; status == 0 && i < scenario_count; i++) {
+        scenarios[i].engine = ENGINE_HEAP;
+        scenarios[i].arity = 4;
+        scenarios[i].bays = i == 0 ? 0 : atoi(bay_counts[i - 1]);
+        for (int level = 0; level < WAIT_HISTOGRAM_LEVELS; level++) {
+            scenarios[i].treatment_ns[level] = (uint64_t)(treatment_minutes * 60e9);
+        }
+    }
+    uint64_t started = monotonic_ns();
+    if (status == 0) {
+        status = run_simulations(records, count, scenarios, results, scenario_count, processors > 0 ? (int)processors : 1);
+    }
+    double seconds = (double)(monotonic_ns() - started) / 1e9;
+    if (status == 0) {
+        long long events = 0;
+        printf("%-10s %10s %10s %8s", "bays", "treated", "waiting", "peak");
+        for (int level = 1; level <= 5; level++) {
+            printf("  p90 L%d min", level);
+        }
+        printf("\n");
+        for (int i = 0; i < scenario_count; i++) {
+            if (scenarios[i].bays > 0) {
+                printf("%-10d", scenarios[i].bays);
+            } else {
+                printf("%-10s", "recorded");
+            }
+            printf(" %10lld %10d %8d", results[i].treated, results[i].still_waiting, results[i].peak_waiting);
+            for (int level = 1; level <= 5; level++) {
+                printf(" %11.1f", (double)results[i].waits[level].p90_ms / 60000.0);
+            }
+            printf("\n");
+            events += results[i].events;
+        }
+        printf("%lld events in %.3f s (%.0f events/s)\n", events, seconds, seconds > 0 ? (double)events / seconds : 0.0);
     } else {
-        printf("  Total patients waiting: %d\n", system->waiting_list->size);
-        Patient next_patient = system->waiting_list->patients[0]; // The root of the heap is next.
-        printf("  Next to be treated: ID: %d, Name: %s, Priority: %d\n", next_patient.patient_id, next_patient.name, next_patient.priority_level);
+        fprintf(stderr, "triage: simulation failed\n");
     }
-    printf("--------------------------\n");
+    free(scenarios);
+    free(results);
+    free(records);
+    return status == 0 ? 0 : 1;
 }
 
-// Displays the log of all treated patients.
-void view_treated_log(TriageSystem* system) {
-    printf("\n--- Log of Treated Patients ---\n");
-    if (system->treated_log->size == 0) {
-        printf("  (No patients have been treated yet)\n");
+// Checks crash recovery end to end on a virtual clock: a patient is admitted an
+// hour in, a checkpoint is taken, a second patient arrives and is treated, and the
+// process "crashes" after the commit. The state is then restored from the snapshot
+// and the log into a system whose clock starts over at one minute, and the first
+// patient is treated. Every wait must come out as the real one, and treatment
+// times must stay in order. Returns the process exit status.
+int run_recovery_check(void) {
+    char wal_path[] = "/tmp/triage-check-XXXXXX";
+    int fd = mkstemp(wal_path);
+    if (fd < 0) {
+        perror("triage: cannot create a scratch file");
+        return 1;
+    }
+    close(fd);
+    char snapshot_path[sizeof(wal_path) + 9];
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snapshot", wal_path);
+    const uint64_t second = 1000000000u;
+    uint64_t now = 0;
+    TriageClock clock = {manual_clock_now, &now};
+    int failures = 0;
+
+    TriageSystem* before = create_triage_system(8);
+    WriteAheadLog* wal = open_write_ahead_log(wal_path, 16);
+    if (before == NULL || wal == NULL) {
+        failures++;
     } else {
-        for (int i = 0; i < system->treated_log->size; i++) {
-            Patient p = system->treated_log->patients[i];
-            printf("  ID: %d, Name: %s, Priority: %d\n", p.patient_id, p.name, p.priority_level);
+        set_triage_clock(before, clock);
+        attach_write_ahead_log(before, wal);
+        now = 3600 * second;
+        add_patient(before, "Waiting since the first hour", 2);
+        failures += checkpoint_triage_system(before, snapshot_path) != 0;
+        now = 7200 * second;
+        add_patient(before, "Arrived in the second hour", 1);
+        now += 30 * second;
+        failures += treat_next_patient(before) == -1;
+        failures += commit_write_ahead_log(wal) != 0;
+    }
+    if (before != NULL) {
+        free_triage_system(before); // The crash: nothing after the commit survives.
+    }
+    if (wal != NULL) {
+        close_write_ahead_log(wal);
+    }
+
+    TriageSystem* after = failures == 0 ? restore_triage_snapshot(snapshot_path) : NULL;
+    if (after == NULL) {
+        failures++;
+    } else {
+        now = 60 * second; // The new process's clock starts over.
+        set_triage_clock(after, clock);
+        failures += replay_write_ahead_log(after, wal_path) != 2;
+        failures += triage_now(after) < 7230 * second;
+        failures += treat_next_patient(after) == -1;
+        WaitTimeSummary urgent;
+        WaitTimeSummary stable;
+        get_wait_time_summary(after, 1, &urgent);
+        get_wait_time_summary(after, 2, &stable);
+        failures += urgent.count != 1 || urgent.max_ms > 31 * 1000;
+        failures += stable.count != 1 || stable.max_ms < 3630 * 1000 || stable.max_ms > 3900 * 1000;
+        const TreatedLog* log = after->treated_log;
+        for (int i = 1; i < log->size; i++) {
+            failures += treated_log_time(log, i) < treated_log_time(log, i - 1);
         }
+        free_triage_system(after);
     }
-    printf("-----------------------------\n");
+    unlink(wal_path);
+    unlink(snapshot_path);
+    printf("Recovery check %s.\n", failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
 }
 
-int main() {
+// Runs the sample emergency room scenario.
+void run_demo(void) {
     // Create the system with an initial capacity of 20 patients.
     TriageSystem* er = create_triage_system(20);
+    set_event_sink(er, console_event_sink());
 
     printf("--- Emergency Room Simulation Started ---\n\n");
     // Add patients with priorities out of order to show the heap works correctly.
@@ -228,6 +5988,32 @@ int main() {
 
     // Clean up all the memory we allocated.
     free_triage_system(er);
+}
 
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench-heap") == 0) {
+        run_heap_benchmark();
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "serve") == 0) {
+        return run_service_command(argv[2]);
+    }
+    if (argc > 1 && strcmp(argv[1], "check-recovery") == 0) {
+        return run_recovery_check();
+    }
+    if (argc > 3 && strcmp(argv[1], "simulate") == 0) {
+        return run_simulate_command(argv[2], atof(argv[3]), argv + 4, argc - 4);
+    }
+    if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        int patients = argc > 2 ? atoi(argv[2]) : 100000;
+        run_stats_command(patients < 1 ? 1 : patients);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int max_patients = argc > 2 ? atoi(argv[2]) : 1000000;
+        run_load_benchmark(max_patients < 1000 ? 1000 : max_patients);
+        return 0;
+    }
+    run_demo();
     return 0;
 }